@@ -1,3 +1,34 @@
+# Optimization profiles of the benchmark targets, see
+# set_optimization_profile below. Both are off by default.
+option(RESOURCE_MANAGER_LTO
+  "Build the benchmarks with link-time optimization" OFF)
+set(RESOURCE_MANAGER_PGO "OFF" CACHE STRING
+  "Profile-guided optimization of the benchmarks: OFF, GENERATE or USE")
+set_property(CACHE RESOURCE_MANAGER_PGO PROPERTY STRINGS OFF GENERATE USE)
+set(RESOURCE_MANAGER_PGO_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH
+  "Directory for the profiles written by GENERATE and read by USE")
+
+if(NOT RESOURCE_MANAGER_PGO MATCHES "^(OFF|GENERATE|USE)$")
+  message(FATAL_ERROR "RESOURCE_MANAGER_PGO must be OFF, GENERATE or USE, "
+    "not '${RESOURCE_MANAGER_PGO}'")
+endif()
+
+if(RESOURCE_MANAGER_LTO)
+  include(CheckIPOSupported)
+  check_ipo_supported(RESULT RESOURCE_MANAGER_LTO_SUPPORTED OUTPUT lto_output)
+  if(NOT RESOURCE_MANAGER_LTO_SUPPORTED)
+    message(FATAL_ERROR
+      "Link-time optimization is not supported: ${lto_output}")
+  endif()
+endif()
+
+# Clang writes raw profiles, which have to be merged for USE.
+if(RESOURCE_MANAGER_PGO STREQUAL "GENERATE"
+   AND CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+  find_program(LLVM_PROFDATA NAMES llvm-profdata
+    HINTS "${CMAKE_CXX_COMPILER}/.." REQUIRED)
+endif()
+
 # Function to set compiler options for a target
 function(set_compiler_options target)
   # Common compiler flags
@@ -46,4 +77,47 @@ function(set_compiler_options target)
     -Os
     -DNDEBUG
   >)
-endfunction() 
\ No newline at end of file
+endfunction() 
+
+# Function to apply the LTO and PGO profiles to a benchmark target. With
+# RESOURCE_MANAGER_PGO=GENERATE the target is instrumented and running it
+# (see the bench_train target) writes profiles to RESOURCE_MANAGER_PGO_DIR.
+# Reconfiguring the same build directory with USE then optimizes with them.
+# The counters are updated atomically, since the benchmarks are
+# multithreaded.
+function(set_optimization_profile target)
+  if(RESOURCE_MANAGER_LTO)
+    set_property(TARGET ${target} PROPERTY INTERPROCEDURAL_OPTIMIZATION TRUE)
+  endif()
+
+  if(RESOURCE_MANAGER_PGO STREQUAL "GENERATE")
+    target_compile_options(${target} PRIVATE
+      -fprofile-generate=${RESOURCE_MANAGER_PGO_DIR}
+      -fprofile-update=atomic
+    )
+    target_link_options(${target} PRIVATE
+      -fprofile-generate=${RESOURCE_MANAGER_PGO_DIR}
+    )
+  elseif(RESOURCE_MANAGER_PGO STREQUAL "USE")
+    # Clang reads ${RESOURCE_MANAGER_PGO_DIR}/default.profdata. Stale or
+    # missing profiles must not fail the build under -Werror.
+    target_compile_options(${target} PRIVATE
+      -fprofile-use=${RESOURCE_MANAGER_PGO_DIR}
+    )
+    target_link_options(${target} PRIVATE
+      -fprofile-use=${RESOURCE_MANAGER_PGO_DIR}
+    )
+    if(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+      target_compile_options(${target} PRIVATE
+        -Wno-profile-instr-unprofiled
+        -Wno-error=profile-instr-out-of-date
+      )
+    else()
+      target_compile_options(${target} PRIVATE
+        -fprofile-correction
+        -Wno-missing-profile
+        -Wno-error=coverage-mismatch
+      )
+    endif()
+  endif()
+endfunction()
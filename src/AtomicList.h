@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <ranges>
+#include <type_traits>
+#include <utility>
 
 // In this file we implement a high performance append-only bounded
 // list. The list is bounded in that one can specify a limit on the used
@@ -15,51 +23,177 @@
 // linked list. One can only prepend new items and get a snapshot in form
 // of a raw pointer to a Node. With this one can traverse the list but
 // one must not free it.
-template <typename T> class AtomicList {
+// With `Arena = true` the nodes are not allocated one by one, but bump
+// allocated from chunks. Every thread which prepends to a list gets a chunk
+// of its own for this list, so no synchronization is needed to allocate
+// a node, and the nodes written by a thread are adjacent in memory. The
+// chunks are freed together with the list, which is a handful of frees
+// instead of one per node (and no traversal at all for trivially
+// destructible T). A thread which switches to another list abandons the
+// rest of its chunk, so this mode is meant for lists which are written by
+// a fixed set of threads, one list at a time, as in the BoundedLists.
+// The accounted memory usage (see below) only counts the items, not the
+// chunks: a list written by N threads holds at least N * ARENA_CHUNK_BYTES,
+// however few items it has.
+// Every node has a sequence number which is one larger than that of its
+// successor, the oldest node gets the `firstSeq` given to the constructor.
+// It is assigned in the same compare-exchange loop which links the node, so
+// it costs no additional synchronization. Only nodes which become the head
+// store it: the older nodes of a batch (see `prepend_batch`) have theirs
+// implied by the newest one, so readers take the number of the snapshot
+// and count down along the list.
+// The list also accounts the memory usage of its items, if the caller
+// passes it to `prepend`. The counter shares the cache line with the head,
+// so a prepend still touches only a single contended cache line.
+template <typename T, bool Arena = false> class AtomicList {
 public:
   // Note that Nodes use bare pointers, since AtomicList guards the allocation
   // of the whole list.
   struct Node {
     T _data;
     Node *_next;
+    uint64_t _seq; // only valid for nodes which were the head, see above
 
-    Node(const T &value) : _data(value), _next(nullptr) {}
+    Node(const T &value) : _data(value), _next(nullptr), _seq(0) {}
+    Node(T &&value) : _data(std::move(value)), _next(nullptr), _seq(0) {}
     Node *next() { return _next; }
   };
 
+  // Size of an arena chunk, see above.
+  static constexpr size_t ARENA_CHUNK_BYTES = 16384;
+
 private:
-  std::atomic<Node *> _head;
+  alignas(64) std::atomic<Node *> _head;
+  std::atomic<size_t> _memoryUsage{0};
+
+  // Arena mode: a chunk holds the nodes of one thread for one list.
+  struct Chunk {
+    static constexpr size_t BYTES = ARENA_CHUNK_BYTES;
+    static constexpr size_t CAPACITY =
+        std::max<size_t>(1, (BYTES - 2 * sizeof(void *)) / sizeof(Node));
+
+    Chunk *next = nullptr;
+    size_t used = 0; // only written by the owning thread
+    alignas(Node) unsigned char storage[CAPACITY * sizeof(Node)];
+
+    Node *node(size_t i) {
+      return std::launder(reinterpret_cast<Node *>(storage) + i);
+    }
+  };
+
+  // The thread's current chunk. Lists are identified by a unique id rather
+  // than their address, so a new list at the address of a freed one is not
+  // mistaken for it.
+  struct ArenaCache {
+    uint64_t listId = 0;
+    Chunk *chunk = nullptr;
+  };
+  static inline std::atomic<uint64_t> _nextListId{1};
+  static inline constinit thread_local ArenaCache _arenaCache{};
+
+  std::atomic<Chunk *> _chunks{nullptr};
+  uint64_t _listId = 0;
+  uint64_t _firstSeq = 0;
+
+  // Tells if `prepend_batch` may move the items out of a range: if it owns
+  // them, because it is a container passed as an rvalue, or if it yields
+  // rvalues anyway.
+  template <typename R>
+  static constexpr bool movesItems =
+      !std::is_lvalue_reference_v<std::ranges::range_reference_t<R>> ||
+      (!std::is_lvalue_reference_v<R> &&
+       !std::ranges::view<std::remove_cvref_t<R>>);
+
+  // Constructs the node from `value`, which is moved from if it is an
+  // rvalue and copied otherwise.
+  template <typename U> Node *allocate(U &&value) {
+    if constexpr (Arena) {
+      ArenaCache &cache = _arenaCache;
+      if (cache.listId != _listId || cache.chunk->used == Chunk::CAPACITY) {
+        Chunk *chunk = new Chunk;
+        // Publish the chunk so that the destructor finds it:
+        Chunk *old = _chunks.load(std::memory_order_relaxed);
+        do {
+          chunk->next = old;
+        } while (!_chunks.compare_exchange_weak(old, chunk,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+        cache.listId = _listId;
+        cache.chunk = chunk;
+      }
+      Chunk *chunk = cache.chunk;
+      Node *node =
+          new (chunk->node(chunk->used)) Node(std::forward<U>(value));
+      ++chunk->used;
+      return node;
+    } else {
+      return new Node(std::forward<U>(value));
+    }
+  }
+
+  // Frees a chain of nodes which was never linked into the list. Nodes in
+  // an arena stay in their chunk and are destroyed with the list.
+  void dropChain([[maybe_unused]] Node *node) noexcept {
+    if constexpr (!Arena) {
+      while (node != nullptr) {
+        Node *next = node->_next;
+        delete node;
+        node = next;
+      }
+    }
+  }
 
 public:
-  AtomicList() : _head(nullptr) {}
+  explicit AtomicList(uint64_t firstSeq = 0)
+      : _head(nullptr), _firstSeq(firstSeq) {
+    if constexpr (Arena) {
+      _listId = _nextListId.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
 
   // It is *not* safe to destruct the AtomicList whilst other threads are
   // still prepending! The user of the class has to ensure that this is
   // done properly!
   ~AtomicList() {
-    Node *n = _head.load();
-    while (n != nullptr) {
-      Node *next = n->next();
-      delete n;
-      n = next;
+    if constexpr (Arena) {
+      Chunk *chunk = _chunks.load(std::memory_order_acquire);
+      while (chunk != nullptr) {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+          for (size_t i = 0; i < chunk->used; ++i) {
+            chunk->node(i)->~Node();
+          }
+        }
+        Chunk *next = chunk->next;
+        delete chunk;
+        chunk = next;
+      }
+    } else {
+      Node *n = _head.load();
+      while (n != nullptr) {
+        Node *next = n->next();
+        delete n;
+        n = next;
+      }
     }
     _head.store(nullptr);
   }
 
-  void prepend(T &&value) noexcept {
+  // Returns false if the item was dropped.
+  bool prepend(T &&value) noexcept {
     Node *new_node;
     try {
-      new_node = new Node(std::move(value));
+      new_node = allocate(std::move(value));
     } catch (...) {
       // We intentionally ignore out-of-memory errors and simply drop the
       // item to be noexcept.
-      return;
+      return false;
     }
     Node *old_head;
 
     do {
       old_head = _head.load();
       new_node->_next = old_head;
+      new_node->_seq = old_head != nullptr ? old_head->_seq + 1 : _firstSeq;
       // The following compare_exchange_weak synchronizes with the
       // load in getSnapShot, therefore we use release semantics here.
       // In the case that the compare_exchange_weak fails the reload
@@ -68,6 +202,135 @@ public:
     } while (!_head.compare_exchange_weak(old_head, new_node,
                                           std::memory_order_release,
                                           std::memory_order_acquire));
+    return true;
+  }
+
+  // Prepend an item which uses `bytes` of memory. Returns the memory usage
+  // of the list including this item.
+  size_t prepend(T &&value, size_t bytes) noexcept {
+    if (!prepend(std::move(value))) {
+      return memoryUsage();
+    }
+    return _memoryUsage.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  }
+
+  // Prepend all items of a range as if they were prepended one by one, so
+  // the last one becomes the head. The items are linked into a private
+  // chain, which is then spliced in with a single compare-exchange, and
+  // their memory usage, as given by `bytesOf`, is accounted with a single
+  // update. Returns the memory usage of the list including the batch.
+  // The items are moved out of a container which is passed as an rvalue and
+  // out of ranges which yield rvalues, and are copied otherwise, so that a
+  // container passed as an lvalue (or through a view) stays as it is.
+  // Items which cannot be allocated are dropped like in `prepend`. If the
+  // range or `bytesOf` throws, the list is left as it was, the items taken
+  // so far are dropped and the exception is propagated.
+  template <std::ranges::input_range R, typename BytesOf>
+    requires std::same_as<std::ranges::range_value_t<R>, T> &&
+             std::is_invocable_r_v<size_t, BytesOf, T const &> &&
+             (movesItems<R> || std::copy_constructible<T>)
+  size_t prepend_batch(R &&items, BytesOf &&bytesOf) {
+    Node *first = nullptr; // the newest node of the chain
+    Node *last = nullptr;  // the oldest node of the chain
+    size_t count = 0;
+    size_t bytes = 0;
+    try {
+      for (auto &&item : items) {
+        size_t itemBytes = bytesOf(std::as_const(item));
+        Node *node;
+        try {
+          if constexpr (movesItems<R>) {
+            node = allocate(std::move(item));
+          } else {
+            node = allocate(std::as_const(item));
+          }
+        } catch (...) {
+          continue; // dropped like in `prepend`
+        }
+        node->_next = first;
+        first = node;
+        if (last == nullptr) {
+          last = node;
+        }
+        ++count;
+        bytes += itemBytes;
+      }
+    } catch (...) {
+      dropChain(first);
+      throw;
+    }
+    if (first == nullptr) {
+      return memoryUsage();
+    }
+
+    // Only the new head gets its sequence number, so a retry costs the same
+    // however long the batch is.
+    Node *old_head = _head.load();
+    do {
+      last->_next = old_head;
+      first->_seq =
+          (old_head != nullptr ? old_head->_seq + 1 : _firstSeq) + count - 1;
+      // Same memory orders as in `prepend`
+    } while (!_head.compare_exchange_weak(old_head, first,
+                                          std::memory_order_release,
+                                          std::memory_order_acquire));
+    return _memoryUsage.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  }
+
+  template <std::ranges::input_range R>
+    requires std::same_as<std::ranges::range_value_t<R>, T> &&
+             (movesItems<R> || std::copy_constructible<T>)
+  void prepend_batch(R &&items) {
+    prepend_batch(std::forward<R>(items), [](T const &) { return size_t{0}; });
+  }
+
+  // Sum of the `bytes` of all items in the list. This is exact once no
+  // thread prepends any more.
+  size_t memoryUsage() const noexcept {
+    return _memoryUsage.load(std::memory_order_relaxed);
+  }
+
+  // Frees up to `maxNodes` nodes, so a list can be destroyed in slices, and
+  // returns the number of nodes freed. In arena mode whole chunks are freed,
+  // so this can overshoot `maxNodes` by a chunk. Like the destructor, this
+  // must not be called while other threads still access the list.
+  size_t releaseNodes(size_t maxNodes) {
+    size_t freed = 0;
+    if constexpr (Arena) {
+      _head.store(nullptr, std::memory_order_relaxed);
+      Chunk *chunk = _chunks.load(std::memory_order_acquire);
+      while (chunk != nullptr && freed < maxNodes) {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+          for (size_t i = 0; i < chunk->used; ++i) {
+            chunk->node(i)->~Node();
+          }
+        }
+        freed += chunk->used;
+        Chunk *next = chunk->next;
+        delete chunk;
+        chunk = next;
+      }
+      _chunks.store(chunk, std::memory_order_relaxed);
+    } else {
+      Node *n = _head.load(std::memory_order_acquire);
+      while (n != nullptr && freed < maxNodes) {
+        Node *next = n->next();
+        delete n;
+        n = next;
+        ++freed;
+      }
+      _head.store(n, std::memory_order_relaxed);
+    }
+    return freed;
+  }
+
+  // True if no node is allocated (any more).
+  bool empty() const noexcept {
+    if constexpr (Arena) {
+      return _chunks.load(std::memory_order_acquire) == nullptr;
+    } else {
+      return _head.load(std::memory_order_acquire) == nullptr;
+    }
   }
 
   // Returns a snapshot of the list at the moment of calling.
@@ -1,10 +1,16 @@
 #pragma once
 
 #include "AtomicList.h"
+#include "ExportBuffer.h"
+#include "ListHistory.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <ranges>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
@@ -19,38 +25,62 @@
 // configured with the _maxHistory argument. The total upper limit for the
 // memory usage (which can occasionally overshoot a bit) is thus
 //   _memoryThreshold * _maxHistory.
+// The memory usage is accounted per list (see AtomicList), so items which
+// are prepended to a list while it is rotated out count towards that list
+// and `memoryUsage` reports exactly what is retained.
 // The forItems method provides a convenient way
 // to iterate over all items in the list from newest to oldest, executing a
 // callback function for each item. Note that it internally takes a snapshot
 // of the current list and of all historic lists, so it is safe to call this
-// method from multiple threads concurrently.
+// method from multiple threads concurrently. The snapshot is a view which is
+// published at every rotation (see ListHistory), so forItems neither takes a
+// lock nor allocates. Items prepended to a new current list only become
+// visible once the rotation has published the view containing it. Writers
+// which are still on a rotated out list hide the newer lists from the cursor
+// paths (`forItems(since, ...)` and `exportItems`) until they have left
+// it, so that a cursor never moves past an item which is still to come.
+// While lists are hidden, these may publish a new view once they are not.
 // The type T must be an object which has a move constructor and has
 // a method called `memoryUsage` which estimates the memory usage
 // (including all substructures) in bytes. It should always return a
 // positive value, but this is intentionally not enforced.
-template <typename T> class BoundedList {
+template <typename T, bool Arena = false, typename Metrics = NoMetrics>
+class BoundedList {
 public: // just for debugging, remove this later!
   static_assert(std::is_object_v<T>, "T must be an object type");
   static_assert(
       std::is_same_v<decltype(std::declval<T>().memoryUsage()), size_t>,
       "T must have a memoryUsage() method returning size_t");
-  std::atomic<std::shared_ptr<AtomicList<T>>> _current;
-  std::atomic<std::size_t> _memoryUsage;
+
+  // With Arena = true the nodes of a list are allocated in chunks, see
+  // AtomicList. The chunks are not part of the memory usage which is
+  // compared to the threshold, every thread which writes to a list holds a
+  // chunk of List::ARENA_CHUNK_BYTES (16 KiB) in it on top of its items.
+  using List = AtomicList<T, Arena>;
+  using History = ListHistory<List, Metrics>;
+
+  std::atomic<std::shared_ptr<List>> _current;
+  // Writers announce themselves here while they prepend, so that a rotation
+  // can tell when all writers of the old current list have left it
+  EpochDomain<Metrics> _writers;
   char padding[64]; // Put subsequent entries on a different cache line
   std::atomic<bool> _isRotating{false}; // Flag to coordinate rotation
-  std::vector<std::shared_ptr<AtomicList<T>>> _history;
-  std::vector<std::shared_ptr<AtomicList<T>>> _trash;
-  size_t _ringBufferPos;
-  mutable std::mutex _mutex; // protecting write access to _current and _history
+  History _history; // historic lists, view for readers and trash
   const std::size_t _memoryThreshold;
   const std::size_t _maxHistory;
 
 public:
   // The actual memory usage is max_history * memory_threshold and some minor
-  // overshooting is possible!
+  // overshooting is possible! In arena mode add up to
+  //   writer threads * 16 KiB * (max_history + 1)
+  // for the chunks, so the threshold should be well above
+  // writer threads * 16 KiB there.
   BoundedList(std::size_t memoryThreshold, std::size_t maxHistory)
-      : _current(std::make_shared<AtomicList<T>>()), _memoryUsage(0),
-        _history(maxHistory), _ringBufferPos(0),
+      : _current(std::make_shared<List>(History::listSeq(1))),
+        _history(maxHistory, _current.load().get(),
+                 [this](uint64_t epoch) {
+                   return _writers.try_reclaim(epoch);
+                 }),
         _memoryThreshold(memoryThreshold), _maxHistory(maxHistory) {
     // The constructor exception could be more specific:
     if (memoryThreshold == 0 || maxHistory < 2) {
@@ -63,34 +93,63 @@ public:
   void prepend(T &&value) {
     // Can throw in out of memory situations!
     auto mem_usage = value.memoryUsage();
+    // The announcement covers the load and the prepend, see tryRotateLists.
+    auto writer = _writers.pin();
     // This load may synchronize with a store which has inserted a new
     // list in this very method below, therefore acquire semantics.
-    std::shared_ptr<AtomicList<T>> current =
+    std::shared_ptr<List> current =
         _current.load(std::memory_order_acquire);
-    current->prepend(std::move(value));
-
     // We assume throughout that `size_t` is at least 64bits and over- or
     // underflow is not a problem.
-    size_t newUsage =
-        _memoryUsage.fetch_add(mem_usage, std::memory_order_relaxed) +
-        mem_usage;
+    size_t newUsage = current->prepend(std::move(value), mem_usage);
+    writer.reset();
+
+    if (newUsage >= _memoryThreshold) {
+      tryRotateLists(current);
+    }
+  }
+
+  // Prepend all items of the range, the last one becomes the newest. This
+  // costs a single epoch announcement, a single compare-exchange and a
+  // single counter update for the whole batch.
+  template <std::ranges::input_range R>
+    requires std::same_as<std::ranges::range_value_t<R>, T>
+  void prepend_batch(R &&items) {
+    auto writer = _writers.pin();
+    std::shared_ptr<List> current =
+        _current.load(std::memory_order_acquire);
+    size_t newUsage = current->prepend_batch(
+        std::forward<R>(items),
+        [](T const &item) { return item.memoryUsage(); });
+    writer.reset();
 
     if (newUsage >= _memoryThreshold) {
       tryRotateLists(current);
     }
   }
 
-  // Try to rotate lists without blocking.
-  void tryRotateLists(std::shared_ptr<AtomicList<T>> &expectedCurrent) {
+  // A writer which finds the list full while another thread rotates it backs
+  // off for a bounded time, see ListHistory::awaitRotation.
+  void awaitRotation() const { History::awaitRotation(_isRotating); }
+
+  // Try to rotate lists. Only the thread which takes the rotation flag
+  // rotates, the others back off for a while, see `awaitRotation`.
+  void tryRotateLists(std::shared_ptr<List> &expectedCurrent) {
     // For a specific value of _current, we want that only one thread actually
     // does the rotation. So, when the threshold is reached, we race on the
     // _isRotating flag, which is only reset by the winner, once _current is
-    // changed.
+    // changed. Until then, every prepend to the full list ends up here, so
+    // look at the flag before trying to take it.
+    if (_isRotating.load(std::memory_order_relaxed)) {
+      awaitRotation();
+      return;
+    }
     bool expected = false;
     if (!_isRotating.compare_exchange_strong(expected, true,
                                              std::memory_order_relaxed,
                                              std::memory_order_relaxed)) {
       // Another thread is already handling rotation
+      awaitRotation();
       return;
     }
 
@@ -107,39 +166,25 @@ public:
       return;
     }
 
-    // First reset the memory usage counter to prevent other threads from
-    // triggering additional rotations
-    _memoryUsage.store(0, std::memory_order_relaxed);
-
-    // Create a new empty list that will become the current list
-    auto newList = std::make_shared<AtomicList<T>>();
+    // Create a new empty list that will become the current list, its items
+    // are numbered after all older ones
+    auto newList = std::make_shared<List>(_history.nextListSeq());
 
     // Then replace the current list
     _current.store(newList, std::memory_order_release);
     // From now on, new threads entering `prepend` will see the new list
-    // and append there. Note that it is possible that some threads have
-    // still prepended to the old current list, but have already accounted
-    // for the memory usage in _memoryUsage, which is already counted towards
-    // the new list. We tolerate this because it is harmless and we want to
-    // reduce contention on _isRotating.
-
-    // Now update the ring buffer:
-    {
-      // This mutex is needed to protect the ring buffer from being read
-      // by some other thread in the forItems method. Writing threads cannot
-      // reach this place because of the _isRotating flag.
-      std::lock_guard<std::mutex> guard(_mutex);
-
-      // Move the old current list into the ring buffer
-      auto toDelete = std::move(_history[_ringBufferPos]);
-      _history[_ringBufferPos] = std::move(expectedCurrent);
-      _ringBufferPos = (_ringBufferPos + 1) % _maxHistory;
-
-      // Schedule the old list for deletion
-      if (toDelete != nullptr) {
-        _trash.emplace_back(std::move(toDelete));
-      }
-    }
+    // and append there. Note that it is possible that some threads still
+    // prepend to the old current list, their memory usage is accounted
+    // there. They might try to rotate again, but then find that the
+    // current list has changed. Writers which announced themselves up to
+    // the retire epoch may still be on the old list, they keep the newer
+    // lists hidden from the cursor paths until they have left.
+    uint64_t epoch = _writers.advance();
+
+    // Now update the ring buffer and publish the new view for readers.
+    // Writing threads cannot reach this place because of the _isRotating
+    // flag.
+    _history.rotate(std::move(expectedCurrent), newList.get(), epoch);
 
     // Release the rotation lock
     _isRotating.store(false, std::memory_order_release);
@@ -148,37 +193,65 @@ public:
   template <typename F>
     requires std::is_invocable_v<F, T const &>
   void forItems(F &&callback) const {
-    // Get snapshots under lock
-    std::vector<std::shared_ptr<AtomicList<T>>> snapshots;
-    {
-      std::lock_guard<std::mutex> guard(_mutex);
-      snapshots.reserve(_history.size() + 1);
-      snapshots.push_back(_current.load(std::memory_order_acquire));
-
-      for (size_t i = 0; i < _maxHistory; ++i) {
-        size_t pos = (_ringBufferPos + _maxHistory - 1 - i) % _maxHistory;
-        if (_history[pos] != nullptr) {
-          snapshots.push_back(_history[pos]);
-        }
-      }
-    }
-
     // Process items from newest to oldest
-    for (const auto &list : snapshots) {
-      auto *node = list->getSnapshot();
+    _history.forLists([&callback](List const &list) {
+      auto *node = list.getSnapshot();
       while (node != nullptr) {
         callback(node->_data);
         node = node->next();
       }
-    }
+    });
+  }
+
+  // Calls `callback(seq, item)` for the items with a sequence number larger
+  // than `since`, newest first, until `limit` items have been delivered or
+  // the callback returns false. Since sequence numbers decrease along the
+  // iteration, it stops at the first older item and does not touch the
+  // lists behind it. Returns the largest sequence number delivered, or
+  // `since` if there was none, so that polling with the result as the next
+  // cursor delivers every item once (unless the limit skipped it).
+  template <typename F>
+    requires std::is_invocable_r_v<bool, F, uint64_t, T const &>
+  uint64_t forItems(uint64_t since, size_t limit, F &&callback) const {
+    return _history.forItems(since, limit, std::forward<F>(callback));
+  }
+
+  // Writes the items with a sequence number larger than `since`, newest
+  // first and at most `limit` of them, into `buffer` in the binary format of
+  // ExportBuffer, one batch per list (or several if it holds more than
+  // 4 GiB). The buffer is cleared first and can be reused for the next
+  // export, so apart from growing the buffer this does not allocate, and
+  // every item is encoded directly into it. Returns the cursor for the next
+  // export like `forItems`. Throws std::length_error for an item of 4 GiB.
+  uint64_t exportItems(ExportBuffer &buffer, uint64_t since = 0,
+                       size_t limit = SIZE_MAX) const
+    requires BinaryExportable<T>
+  {
+    return _history.exportItems(buffer, since, limit);
+  }
+
+  size_t clearTrash() { return _history.clearTrash(); }
+
+  // Incremental freeing of the trash, see ListHistory.
+  size_t reclaimStep(size_t maxNodes) { return _history.reclaimStep(maxNodes); }
+  void startReclaimer(TrashReclaimerOptions options = {}) {
+    _history.startReclaimer(options);
+  }
+  void stopReclaimer() { _history.stopReclaimer(); }
+  size_t pendingTrashBytes() const noexcept { return _history.pendingBytes(); }
+  size_t pendingTrashLists() const noexcept { return _history.pendingLists(); }
+
+  // Rotations, freed lists and nodes (with `Metrics = ThreadMetrics`) and
+  // the current memory usage, to size the threshold and the history.
+  ListHistoryStats stats() const {
+    ListHistoryStats result = _history.stats();
+    result.memory_threshold = _memoryThreshold;
+    return result;
   }
 
-  size_t clearTrash() {
-    // This method is called by a cleanup thread to free old batches.
-    // Returns the number of batches that were freed.
-    std::lock_guard<std::mutex> guard(_mutex);
-    size_t freedBatches = _trash.size();
-    _trash.clear();
-    return freedBatches;
+  // Memory retained by the current and the historic lists, and by lists in
+  // the trash which are not yet freed.
+  size_t memoryUsage() const {
+    return _history.retainedBytes() + _history.pendingBytes();
   }
 };
@@ -1,12 +1,18 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <ranges>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
 #include "AtomicList.h"
+#include "ExportBuffer.h"
+#include "ListHistory.h"
 #include "ResourceManager.h"
 
 namespace arangodb {
@@ -22,38 +28,50 @@ namespace arangodb {
 // be configured with the _maxHistory argument. The total upper limit for the
 // memory usage (which can occasionally overshoot a bit) is thus
 //   _memoryThreshold * _maxHistory.
+// The memory usage is accounted per list (see AtomicList), so `memoryUsage`
+// reports exactly what is retained.
 // The forItems method provides a convenient way to iterate over all items
 // in the list from newest to oldest, executing a callback function for each
 // item. Note that it internally takes a snapshot of the current list and of
 // all historic lists, so it is safe to call this method from multiple threads
-// concurrently.
+// concurrently. The snapshot is a view which is published at every rotation
+// (see ListHistory), so forItems neither takes a lock nor allocates.
+// Rotation never waits for concurrent writers to leave the old list, it
+// only swaps the current list and hands the old one to the ring buffer.
+// The newer lists are hidden from the cursor paths (`forItems(since, ...)`
+// and `exportItems`) until those writers have left, so that a cursor never
+// moves past an item which is still to come. While lists are hidden, these
+// may publish a new view once they are not. Plain forItems shows them all.
 // The type T must be an object which has a move constructor and has
 // a method called `memoryUsage` which estimates the memory usage
 // (including all substructures) in bytes. It should always return a
 // positive value, but this is intentionally not enforced.
-template <typename T> class BoundedList2 {
+template <typename T, bool Arena = false, typename Metrics = NoMetrics>
+class BoundedList2 {
 private:
   static_assert(std::is_object_v<T>, "T must be an object type");
   static_assert(
       std::is_same_v<decltype(std::declval<T>().memoryUsage()), size_t>,
       "T must have a memoryUsage() method returning size_t");
 
-  // ResourceManager for the current list
-  ResourceManager<std::shared_ptr<AtomicList<T>>> _resourceManager;
+  // With Arena = true the nodes of a list are allocated in chunks, see
+  // AtomicList. The chunks are not part of the memory usage which is
+  // compared to the threshold, every thread which writes to a list holds a
+  // chunk of List::ARENA_CHUNK_BYTES (16 KiB) in it on top of its items.
+  using List = AtomicList<T, Arena>;
+  using History = ListHistory<List, Metrics>;
 
-  // Memory usage tracking
-  std::atomic<std::size_t> _memoryUsage;
+  // ResourceManager for the current list, it owns the list until rotation
+  // moves it into the ring buffer
+  ResourceManager<List, Metrics> _resourceManager;
 
   char padding[64]; // Put subsequent entries on a different cache line
   std::atomic<bool> _isRotating{false}; // Flag to coordinate rotation
-                                        //
-  // Ring buffer for historic lists
-  std::vector<std::shared_ptr<AtomicList<T>>> _history;
-  size_t _ringBufferPos;
-  std::vector<std::shared_ptr<AtomicList<T>>> _trash;
+  // Retire epoch of the list rotated out last, see `rotationSettled`
+  std::atomic<uint64_t> _lastRotationEpoch{0};
 
-  // Mutex for protecting the ring buffer and trash
-  mutable std::mutex _mutex;
+  // Ring buffer for historic lists, view for readers and trash
+  History _history;
 
   // Configuration
   const std::size_t _memoryThreshold;
@@ -61,11 +79,22 @@ private:
 
 public:
   // The actual memory usage is max_history * memory_threshold and some minor
-  // overshooting is possible!
+  // overshooting is possible! In arena mode add up to
+  //   writer threads * 16 KiB * (max_history + 1)
+  // for the chunks, so the threshold should be well above
+  // writer threads * 16 KiB there.
   BoundedList2(std::size_t memoryThreshold, std::size_t maxHistory)
-      : _resourceManager(std::make_unique<std::shared_ptr<AtomicList<T>>>(
-            std::make_shared<AtomicList<T>>())),
-        _memoryUsage(0), _history(maxHistory), _ringBufferPos(0),
+      : BoundedList2(memoryThreshold, maxHistory,
+                     new List(History::listSeq(1))) {}
+
+private:
+  BoundedList2(std::size_t memoryThreshold, std::size_t maxHistory,
+               List *initial)
+      : _resourceManager(std::unique_ptr<List>(initial)),
+        _history(maxHistory, initial,
+                 [this](uint64_t epoch) {
+                   return _resourceManager.try_reclaim(epoch);
+                 }),
         _memoryThreshold(memoryThreshold), _maxHistory(maxHistory) {
     // The constructor exception could be more specific:
     if (memoryThreshold == 0 || maxHistory < 2) {
@@ -75,69 +104,100 @@ public:
     }
   }
 
+public:
   void prepend(T &&value) {
     // Can throw in out of memory situations!
     auto mem_usage = value.memoryUsage();
 
-    // Use ResourceManager to access the current list (counts as a read access)
-    _resourceManager.read(
-        [&value](std::shared_ptr<AtomicList<T>> const &current) {
-          current->prepend(std::move(value));
+    // Use ResourceManager to access the current list (counts as a read
+    // access), the list accounts the memory usage. The list is internally
+    // synchronized, so writers modify it through `read_mut`.
+    List *list = nullptr;
+    size_t newUsage = _resourceManager.read_mut(
+        [&value, &list, mem_usage](List &current) {
+          list = &current;
+          return list->prepend(std::move(value), mem_usage);
         });
 
-    // Update memory usage
-    size_t newUsage =
-        _memoryUsage.fetch_add(mem_usage, std::memory_order_relaxed) +
-        mem_usage;
-
     // Check if we need to rotate lists
     if (newUsage >= _memoryThreshold) {
-      tryRotateLists();
+      tryRotateLists(list);
+    }
+  }
+
+  // Prepend all items of the range, the last one becomes the newest. This
+  // costs a single epoch announcement, a single compare-exchange and a
+  // single counter update for the whole batch.
+  template <std::ranges::input_range R>
+    requires std::same_as<std::ranges::range_value_t<R>, T>
+  void prepend_batch(R &&items) {
+    List *list = nullptr;
+    size_t newUsage = _resourceManager.read_mut(
+        [&items, &list](List &current) {
+          list = &current;
+          return list->prepend_batch(
+              std::forward<R>(items),
+              [](T const &item) { return item.memoryUsage(); });
+        });
+
+    if (newUsage >= _memoryThreshold) {
+      tryRotateLists(list);
     }
   }
 
-  // Try to rotate lists without blocking.
-  void tryRotateLists() {
+  // A writer which finds the list full while another thread rotates it backs
+  // off for a bounded time, see ListHistory::awaitRotation.
+  void awaitRotation() const { History::awaitRotation(_isRotating); }
+
+  // Try to rotate lists, if `expectedCurrent` is still the current list.
+  // Only the thread which takes the rotation flag rotates, the others back
+  // off for a while, see `awaitRotation`.
+  void tryRotateLists(List *expectedCurrent) {
     // For a specific value of _current, we want that only one thread actually
     // does the rotation. So, when the threshold is reached, we race on the
     // _isRotating flag, which is only reset by the winner, once _current is
-    // changed.
+    // changed. Until then, every prepend to the full list ends up here, so
+    // look at the flag before trying to take it.
+    if (_isRotating.load(std::memory_order_relaxed)) {
+      awaitRotation();
+      return;
+    }
     bool expected = false;
     if (!_isRotating.compare_exchange_strong(expected, true,
                                              std::memory_order_relaxed,
                                              std::memory_order_relaxed)) {
       // Another thread is already handling rotation
+      awaitRotation();
       return;
     }
 
-    // Reset memory usage counter, so that not more threads get held up:
-    _memoryUsage.store(0, std::memory_order_relaxed);
+    // A thread which was delayed after its prepend must not rotate the
+    // next list, see BoundedList.
+    bool stale = _resourceManager.read(
+        [expectedCurrent](List const &current) {
+          return &current != expectedCurrent;
+        });
+    if (stale) {
+      _isRotating.store(false, std::memory_order_release);
+      return;
+    }
 
-    // Create a new empty list
-    auto newList = std::make_shared<AtomicList<T>>();
+    // Create a new empty list, its items are numbered after all older ones
+    auto newList = std::make_unique<List>(_history.nextListSeq());
+    List *newCurrent = newList.get();
 
     // Update the current list using ResourceManager
     // This returns the old list and its retirement epoch
-    auto [oldList, epoch] = _resourceManager.update(
-        std::make_unique<std::shared_ptr<AtomicList<T>>>(newList));
-
-    // Wait for all readers to finish with the old list
-    _resourceManager.wait_reclaim(epoch);
-
-    // Update the ring buffer under mutex protection
-    {
-      std::lock_guard<std::mutex> guard(_mutex);
+    auto [oldList, epoch] = _resourceManager.update(std::move(newList));
 
-      // Move the old list into the ring buffer
-      auto toDelete = std::move(_history[_ringBufferPos]);
-      _history[_ringBufferPos] = std::move(*oldList);
-      _ringBufferPos = (_ringBufferPos + 1) % _maxHistory;
-
-      // Schedule the old list for deletion
-      if (toDelete != nullptr) {
-        _trash.emplace_back(std::move(toDelete));
-      }
-    }
+    // Writers might still prepend to the old list, but we do not wait for
+    // them. The old list moves into the ring right away, since readers may
+    // traverse a list which is still written to. The epoch hides the new
+    // list from the cursor paths until the last writer has left the old one,
+    // and makes sure that it is not freed from the trash before.
+    _history.rotate(std::shared_ptr<List>(std::move(oldList)), newCurrent,
+                    epoch);
+    _lastRotationEpoch.store(epoch, std::memory_order_release);
 
     // Release the rotation lock
     _isRotating.store(false, std::memory_order_release);
@@ -145,45 +205,86 @@ public:
 
   template <typename F>
     requires std::is_invocable_v<F, T const &>
-  void forItems(F &&callback) {
-    // Get snapshots under lock
-    std::vector<std::shared_ptr<AtomicList<T>>> snapshots;
-    {
-      std::lock_guard<std::mutex> guard(_mutex);
-      snapshots.reserve(_history.size() + 1);
-
-      // Get current list snapshot
-      _resourceManager.read(
-          [&snapshots](std::shared_ptr<AtomicList<T>> const &current) {
-            snapshots.push_back(current);
-          });
-
-      // Get historic lists
-      for (size_t i = 0; i < _maxHistory; ++i) {
-        size_t pos = (_ringBufferPos + _maxHistory - 1 - i) % _maxHistory;
-        if (_history[pos] != nullptr) {
-          snapshots.push_back(_history[pos]);
-        }
-      }
-    }
-
+  void forItems(F &&callback) const {
     // Process items from newest to oldest
-    for (const auto &list : snapshots) {
-      auto *node = list->getSnapshot();
+    _history.forLists([&callback](List const &list) {
+      auto *node = list.getSnapshot();
       while (node != nullptr) {
         callback(node->_data);
         node = node->next();
       }
-    }
+    });
+  }
+
+  // Calls `callback(seq, item)` for the items with a sequence number larger
+  // than `since`, newest first, until `limit` items have been delivered or
+  // the callback returns false. Since sequence numbers decrease along the
+  // iteration, it stops at the first older item and does not touch the
+  // lists behind it. Returns the largest sequence number delivered, or
+  // `since` if there was none, so that polling with the result as the next
+  // cursor delivers every item once (unless the limit skipped it).
+  template <typename F>
+    requires std::is_invocable_r_v<bool, F, uint64_t, T const &>
+  uint64_t forItems(uint64_t since, size_t limit, F &&callback) const {
+    return _history.forItems(since, limit, std::forward<F>(callback));
+  }
+
+  // Writes the items with a sequence number larger than `since`, newest
+  // first and at most `limit` of them, into `buffer` in the binary format of
+  // ExportBuffer, one batch per list (or several if it holds more than
+  // 4 GiB). The buffer is cleared first and can be reused for the next
+  // export, so apart from growing the buffer this does not allocate, and
+  // every item is encoded directly into it. Returns the cursor for the next
+  // export like `forItems`. Throws std::length_error for an item of 4 GiB.
+  uint64_t exportItems(ExportBuffer &buffer, uint64_t since = 0,
+                       size_t limit = SIZE_MAX) const
+    requires BinaryExportable<T>
+  {
+    return _history.exportItems(buffer, since, limit);
   }
 
-  size_t clearTrash() {
-    // This method is called by a cleanup thread to free old batches.
-    // Returns the number of batches that were freed.
-    std::lock_guard<std::mutex> guard(_mutex);
-    size_t freedBatches = _trash.size();
-    _trash.clear();
-    return freedBatches;
+  size_t clearTrash() { return _history.clearTrash(); }
+
+  // Incremental freeing of the trash, see ListHistory.
+  size_t reclaimStep(size_t maxNodes) { return _history.reclaimStep(maxNodes); }
+  // The background reclaimer also resumes coroutines which wait in
+  // `rotationSettled`.
+  void startReclaimer(TrashReclaimerOptions options = {}) {
+    _history.startReclaimer(options);
+    _resourceManager.start_reclaimer(options.idle);
+  }
+  void stopReclaimer() {
+    _resourceManager.stop_reclaimer();
+    _history.stopReclaimer();
+  }
+
+  // Awaitable for coroutines: `co_await list.rotationSettled()` resumes once
+  // all writers have left the lists rotated out so far, so that their items
+  // and memory usage are final. Rotation itself never waits for them. The
+  // coroutine is resumed on the thread of the background reclaimer.
+  auto rotationSettled() {
+    return _resourceManager.reclaimed(
+        _lastRotationEpoch.load(std::memory_order_acquire));
+  }
+  size_t pendingTrashBytes() const noexcept { return _history.pendingBytes(); }
+  size_t pendingTrashLists() const noexcept { return _history.pendingLists(); }
+
+  // Rotations, freed lists and nodes (with `Metrics = ThreadMetrics`) and
+  // the current memory usage, to size the threshold and the history.
+  ListHistoryStats stats() const {
+    ListHistoryStats result = _history.stats();
+    result.memory_threshold = _memoryThreshold;
+    return result;
+  }
+
+  // Slot collisions and probe lengths of the writers, which announce
+  // themselves at the ResourceManager of the current list.
+  ResourceManagerStats writerStats() { return _resourceManager.stats(); }
+
+  // Memory retained by the current and the historic lists, and by lists in
+  // the trash which are not yet freed.
+  size_t memoryUsage() const {
+    return _history.retainedBytes() + _history.pendingBytes();
   }
 };
 
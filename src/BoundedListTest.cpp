@@ -0,0 +1,949 @@
+#include "BoundedList.h"
+#include "BoundedList2.h"
+#include "RingBoundedList.h"
+#include "ShardedBoundedList.h"
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace arangodb;
+
+// Small record which remembers who wrote it and in which order
+struct Record {
+  uint64_t writer;
+  uint64_t seq;
+
+  Record(uint64_t writer, uint64_t seq) : writer(writer), seq(seq) {}
+  size_t memoryUsage() const { return sizeof(Record); }
+};
+
+// Without rotation, every item is delivered exactly once, newest first.
+template <typename ListType> bool test_single_writer(char const *name) {
+  std::cout << "Testing single writer on " << name << std::endl;
+
+  ListType list(1024 * 1024, 4);
+  const uint64_t num_items = 1000;
+  for (uint64_t i = 0; i < num_items; ++i) {
+    list.prepend(Record(0, i));
+  }
+
+  uint64_t expected = num_items;
+  bool ordered = true;
+  list.forItems([&](Record const &record) {
+    ordered = ordered && record.seq + 1 == expected;
+    --expected;
+  });
+  if (!ordered || expected != 0) {
+    std::cout << "Items not delivered newest first, " << expected
+              << " missing" << std::endl;
+    return false;
+  }
+
+  std::cout << "Single writer test on " << name << " passed" << std::endl;
+  return true;
+}
+
+// Concurrent writers with frequent rotation: the memory bound holds
+// roughly, and the items of each writer are delivered newest first.
+template <typename ListType>
+bool test_concurrent_writers(char const *name) {
+  std::cout << "Testing concurrent writers on " << name << std::endl;
+
+  const size_t threshold = 100 * sizeof(Record);
+  const size_t history = 4;
+  ListType list(threshold, history);
+  const uint64_t num_writers = 4;
+  const uint64_t items_per_writer = 20000;
+
+  std::vector<std::thread> writers;
+  for (uint64_t w = 0; w < num_writers; ++w) {
+    writers.emplace_back([&list, w]() {
+      for (uint64_t i = 0; i < items_per_writer; ++i) {
+        list.prepend(Record(w, i));
+      }
+    });
+  }
+  for (auto &thread : writers) {
+    thread.join();
+  }
+  list.clearTrash();
+
+  std::vector<uint64_t> last(num_writers, items_per_writer);
+  size_t count = 0;
+  bool ordered = true;
+  list.forItems([&](Record const &record) {
+    ordered = ordered && record.seq < last[record.writer];
+    last[record.writer] = record.seq;
+    ++count;
+  });
+  if (!ordered) {
+    std::cout << "Items of a writer not delivered newest first" << std::endl;
+    return false;
+  }
+  // Writers which find a full list back off while it is rotated, so a list
+  // normally overshoots the threshold by about one item per writer (plus the
+  // fold quantum of ShardedBoundedList), also if the writers share a core.
+  // The back off is capped, the bound leaves room for a rotating thread
+  // which is preempted for longer:
+  if (count == 0 || count * sizeof(Record) > 2 * threshold * (history + 1)) {
+    std::cout << "Unexpected number of retained items " << count
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Concurrent writers test on " << name << " passed (" << count
+            << " items retained)" << std::endl;
+  return true;
+}
+
+// Arena allocated lists must destroy every item, no matter how many chunks
+// and threads were involved.
+struct Tracked {
+  static inline std::atomic<int64_t> alive{0};
+  std::string text;
+
+  explicit Tracked(std::string t) : text(std::move(t)) { alive.fetch_add(1); }
+  Tracked(const Tracked &other) : text(other.text) { alive.fetch_add(1); }
+  Tracked(Tracked &&other) noexcept : text(std::move(other.text)) {
+    alive.fetch_add(1);
+  }
+  ~Tracked() { alive.fetch_sub(1); }
+};
+
+bool test_arena_destruction() {
+  std::cout << "Testing arena destruction" << std::endl;
+  {
+    AtomicList<Tracked, true> list;
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 3; ++w) {
+      writers.emplace_back([&list, w]() {
+        for (int i = 0; i < 10000; ++i) {
+          list.prepend(Tracked("item " + std::to_string(w) + "/" +
+                               std::to_string(i)));
+        }
+      });
+    }
+    for (auto &thread : writers) {
+      thread.join();
+    }
+    size_t count = 0;
+    for (auto *node = list.getSnapshot(); node != nullptr;
+         node = node->next()) {
+      ++count;
+    }
+    if (count != 30000 || Tracked::alive.load() != 30000) {
+      std::cout << "Unexpected item count " << count << std::endl;
+      return false;
+    }
+  }
+  if (Tracked::alive.load() != 0) {
+    std::cout << Tracked::alive.load() << " items were not destroyed"
+              << std::endl;
+    return false;
+  }
+  std::cout << "Arena destruction test passed" << std::endl;
+  return true;
+}
+
+// Bounded iteration: limits, early stop, and polling with a cursor across
+// rotations delivers exactly the new items.
+template <typename ListType> bool test_paginated_iteration(char const *name) {
+  std::cout << "Testing paginated iteration on " << name << std::endl;
+
+  ListType list(10 * sizeof(Record), 4);
+  for (uint64_t i = 0; i < 25; ++i) {
+    list.prepend(Record(0, i));
+  }
+
+  // The last five items, newest first
+  uint64_t expected = 25;
+  bool ordered = true;
+  uint64_t lastSeq = UINT64_MAX;
+  uint64_t cursor =
+      list.forItems(0, 5, [&](uint64_t seq, Record const &record) {
+        ordered = ordered && seq < lastSeq && record.seq + 1 == expected;
+        lastSeq = seq;
+        --expected;
+        return true;
+      });
+  if (!ordered || expected != 20) {
+    std::cout << "Limit did not deliver the newest items" << std::endl;
+    return false;
+  }
+
+  // Early stop by the callback
+  size_t count = 0;
+  list.forItems(0, SIZE_MAX, [&](uint64_t, Record const &) {
+    return ++count < 2;
+  });
+  if (count != 2) {
+    std::cout << "Callback could not stop the iteration" << std::endl;
+    return false;
+  }
+
+  // Polling: the cursor returns exactly the items added since, even if they
+  // went to a new list.
+  for (uint64_t i = 25; i < 33; ++i) {
+    list.prepend(Record(0, i));
+  }
+  expected = 33;
+  uint64_t next =
+      list.forItems(cursor, SIZE_MAX, [&](uint64_t, Record const &record) {
+        ordered = ordered && record.seq + 1 == expected;
+        --expected;
+        return true;
+      });
+  if (!ordered || expected != 25 || next <= cursor ||
+      list.forItems(next, SIZE_MAX, [](uint64_t, Record const &) {
+        return true;
+      }) != next) {
+    std::cout << "Cursor did not deliver exactly the new items, "
+              << expected - 25 << " missing" << std::endl;
+    return false;
+  }
+
+  std::cout << "Paginated iteration test on " << name << " passed"
+            << std::endl;
+  return true;
+}
+
+// A poller which follows the cursor while writers prepend and rotate gets
+// every item exactly once, also those which land in a list after it was
+// rotated out. The history is long enough that nothing is evicted.
+template <typename ListType> bool test_concurrent_poll(char const *name) {
+  std::cout << "Testing concurrent polling on " << name << std::endl;
+
+  const size_t num_writers = 4;
+  const uint64_t items_per_writer = 20000;
+  ListType list(50 * sizeof(Record),
+                num_writers * items_per_writer / 50 + 10);
+
+  std::vector<std::vector<uint8_t>> seen(
+      num_writers, std::vector<uint8_t>(items_per_writer, 0));
+  uint64_t cursor = 0;
+  bool duplicate = false;
+  auto poll = [&]() {
+    cursor = list.forItems(cursor, SIZE_MAX,
+                           [&](uint64_t, Record const &record) {
+                             auto &count = seen[record.writer][record.seq];
+                             duplicate = duplicate || count != 0;
+                             count = 1;
+                             return true;
+                           });
+  };
+
+  std::atomic<size_t> running{num_writers};
+  std::vector<std::thread> writers;
+  for (size_t w = 0; w < num_writers; ++w) {
+    writers.emplace_back([&list, &running, w, items_per_writer]() {
+      for (uint64_t i = 0; i < items_per_writer; ++i) {
+        list.prepend(Record(w, i));
+      }
+      running.fetch_sub(1);
+    });
+  }
+  while (running.load() > 0) {
+    poll();
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  poll();
+
+  size_t missing = 0;
+  for (auto const &counts : seen) {
+    for (uint8_t count : counts) {
+      missing += count == 0;
+    }
+  }
+  if (duplicate || missing != 0) {
+    std::cout << "Polling skipped " << missing << " items"
+              << (duplicate ? " and delivered some twice" : "") << std::endl;
+    return false;
+  }
+
+  std::cout << "Concurrent polling test on " << name << " passed"
+            << std::endl;
+  return true;
+}
+
+// With concurrent writers and rotation, the reported memory usage matches
+// exactly the items which are retained.
+template <typename ListType> bool test_exact_accounting(char const *name) {
+  std::cout << "Testing exact accounting on " << name << std::endl;
+
+  ListType list(100 * sizeof(Record), 4);
+  std::vector<std::thread> writers;
+  for (uint64_t w = 0; w < 4; ++w) {
+    writers.emplace_back([&list, w]() {
+      for (uint64_t i = 0; i < 20000; ++i) {
+        list.prepend(Record(w, i));
+      }
+    });
+  }
+  for (auto &thread : writers) {
+    thread.join();
+  }
+
+  size_t count = 0;
+  list.forItems([&count](Record const &) { ++count; });
+  size_t retained = list.memoryUsage() - list.pendingTrashBytes();
+  if (retained != count * sizeof(Record)) {
+    std::cout << "Accounted " << retained << " bytes for " << count
+              << " items" << std::endl;
+    return false;
+  }
+  list.clearTrash();
+  if (list.memoryUsage() != count * sizeof(Record)) {
+    std::cout << "Trash still accounted after clearTrash" << std::endl;
+    return false;
+  }
+
+  std::cout << "Exact accounting test on " << name << " passed" << std::endl;
+  return true;
+}
+
+// Batches behave like the same items prepended one by one, also with
+// concurrent writers and rotation.
+template <typename ListType> bool test_batch_prepend(char const *name) {
+  std::cout << "Testing batch prepend on " << name << std::endl;
+
+  // The items of an lvalue batch are copied, those of an rvalue one moved
+  {
+    AtomicList<Tracked> list;
+    std::vector<Tracked> batch;
+    batch.emplace_back("kept");
+    list.prepend_batch(batch);
+    std::vector<Tracked> moved;
+    moved.emplace_back("moved");
+    list.prepend_batch(std::move(moved));
+    if (batch[0].text != "kept" || list.getSnapshot()->_data.text != "moved" ||
+        list.getSnapshot()->next()->_data.text != "kept") {
+      std::cout << "Batch passed as an lvalue was moved from" << std::endl;
+      return false;
+    }
+  }
+
+  // A batch whose accounting throws leaves the list as it was
+  {
+    AtomicList<Tracked> list;
+    std::vector<Tracked> batch;
+    batch.emplace_back("first");
+    batch.emplace_back("second");
+    batch.emplace_back("third");
+    int64_t alive = Tracked::alive.load();
+    bool thrown = false;
+    try {
+      list.prepend_batch(batch, [](Tracked const &item) {
+        if (item.text == "third") {
+          throw std::runtime_error("no size");
+        }
+        return item.text.size();
+      });
+    } catch (std::runtime_error const &) {
+      thrown = true;
+    }
+    if (!thrown || list.getSnapshot() != nullptr ||
+        list.memoryUsage() != 0 || Tracked::alive.load() != alive) {
+      std::cout << "Failed batch was not dropped" << std::endl;
+      return false;
+    }
+  }
+
+  {
+    ListType list(1024 * 1024, 4);
+    std::vector<Record> batch;
+    for (uint64_t i = 0; i < 10; ++i) {
+      batch.emplace_back(0, i);
+    }
+    list.prepend_batch(batch);
+    list.prepend(Record(0, 10));
+    batch.clear();
+    for (uint64_t i = 11; i < 15; ++i) {
+      batch.emplace_back(0, i);
+    }
+    list.prepend_batch(std::move(batch));
+    list.prepend_batch(std::vector<Record>{});
+
+    uint64_t expected = 15;
+    uint64_t lastSeq = UINT64_MAX;
+    bool ordered = true;
+    list.forItems(0, SIZE_MAX, [&](uint64_t seq, Record const &record) {
+      // Sequence numbers are dense within a list
+      ordered = ordered && (lastSeq == UINT64_MAX || seq + 1 == lastSeq) &&
+                record.seq + 1 == expected;
+      lastSeq = seq;
+      --expected;
+      return true;
+    });
+    if (!ordered || expected != 0 ||
+        list.memoryUsage() != 15 * sizeof(Record)) {
+      std::cout << "Batches not delivered like single prepends" << std::endl;
+      return false;
+    }
+  }
+
+  ListType list(100 * sizeof(Record), 4);
+  const uint64_t num_writers = 4;
+  const uint64_t items_per_writer = 20000;
+  std::vector<std::thread> writers;
+  for (uint64_t w = 0; w < num_writers; ++w) {
+    writers.emplace_back([&list, w]() {
+      std::vector<Record> batch;
+      for (uint64_t i = 0; i < items_per_writer; ++i) {
+        batch.emplace_back(w, i);
+        if (batch.size() == 8) {
+          list.prepend_batch(std::move(batch));
+          batch.clear();
+        }
+      }
+    });
+  }
+  for (auto &thread : writers) {
+    thread.join();
+  }
+
+  std::vector<uint64_t> last(num_writers, items_per_writer);
+  size_t count = 0;
+  bool ordered = true;
+  list.forItems([&](Record const &record) {
+    ordered = ordered && record.seq < last[record.writer];
+    last[record.writer] = record.seq;
+    ++count;
+  });
+  if (!ordered ||
+      list.memoryUsage() - list.pendingTrashBytes() != count * sizeof(Record)) {
+    std::cout << "Concurrent batches out of order or miscounted" << std::endl;
+    return false;
+  }
+
+  std::cout << "Batch prepend test on " << name << " passed" << std::endl;
+  return true;
+}
+
+// Lists which are rotated out while a forItems is running stay valid until it
+// has finished, clearTrash must not free them earlier.
+template <typename ListType> bool test_trash_during_snapshot(char const *name) {
+  std::cout << "Testing trash during snapshot on " << name << std::endl;
+
+  ListType list(10 * sizeof(Record), 2);
+  for (uint64_t i = 0; i < 5; ++i) {
+    list.prepend(Record(0, i));
+  }
+
+  uint64_t expected = 5;
+  bool ordered = true;
+  size_t freedWhilePinned = 0;
+  list.forItems([&](Record const &record) {
+    if (expected == 5) {
+      // Rotate often enough to evict the list which is being traversed
+      for (uint64_t i = 0; i < 100; ++i) {
+        list.prepend(Record(1, i));
+      }
+      freedWhilePinned = list.clearTrash();
+    }
+    ordered = ordered && record.writer == 0 && record.seq + 1 == expected;
+    --expected;
+  });
+  size_t freedAfterwards = list.clearTrash();
+  if (!ordered || expected != 0 || freedWhilePinned != 0 ||
+      freedAfterwards == 0) {
+    std::cout << "Snapshot broken or trash freed too early, freed "
+              << freedWhilePinned << " while pinned and " << freedAfterwards
+              << " afterwards" << std::endl;
+    return false;
+  }
+
+  std::cout << "Trash during snapshot test on " << name << " passed"
+            << std::endl;
+  return true;
+}
+
+// The trash is freed in slices of bounded size, by hand or by the
+// background reclaimer, and the pending memory is reported until then.
+template <typename ListType> bool test_incremental_reclaim(char const *name) {
+  std::cout << "Testing incremental reclaim on " << name << std::endl;
+
+  ListType list(10 * sizeof(Record), 2);
+  for (uint64_t i = 0; i < 100; ++i) {
+    list.prepend(Record(0, i));
+  }
+  size_t pendingLists = list.pendingTrashLists();
+  size_t pendingBytes = list.pendingTrashBytes();
+  size_t firstStep = list.reclaimStep(3);
+  size_t freed = firstStep;
+  size_t step;
+  while ((step = list.reclaimStep(3)) > 0) {
+    freed += step;
+  }
+  if (pendingLists == 0 || pendingBytes < pendingLists * sizeof(Record) ||
+      firstStep != 3 || freed != pendingBytes / sizeof(Record) ||
+      list.pendingTrashLists() != 0 || list.pendingTrashBytes() != 0) {
+    std::cout << "Stepwise reclaim freed " << freed << " nodes of "
+              << pendingLists << " pending lists" << std::endl;
+    return false;
+  }
+
+  list.startReclaimer(TrashReclaimerOptions{
+      .nodes_per_step = 4, .pause = std::chrono::microseconds(0)});
+  for (uint64_t i = 0; i < 1000; ++i) {
+    list.prepend(Record(0, i));
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (list.pendingTrashLists() != 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  list.stopReclaimer();
+  if (list.pendingTrashLists() != 0 || list.pendingTrashBytes() != 0) {
+    std::cout << "Background reclaimer left " << list.pendingTrashLists()
+              << " lists behind" << std::endl;
+    return false;
+  }
+
+  std::cout << "Incremental reclaim test on " << name << " passed"
+            << std::endl;
+  return true;
+}
+
+// Item whose move constructor can stall, so that a writer stays inside
+// prepend for as long as the test wants.
+struct Stalling {
+  static inline std::atomic<bool> stall{false};
+  static inline std::atomic<bool> entered{false};
+  static inline std::atomic<bool> release{false};
+  static inline std::atomic<bool> timed_out{false};
+
+  uint64_t value;
+
+  explicit Stalling(uint64_t value) : value(value) {}
+  Stalling(Stalling &&other) noexcept : value(other.value) {
+    if (stall.exchange(false)) {
+      entered = true;
+      auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(5);
+      while (!release) {
+        if (std::chrono::steady_clock::now() > deadline) {
+          timed_out = true;
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+  }
+  size_t memoryUsage() const { return 100; }
+};
+
+// A writer which is stuck in prepend must not hold up the rotation of
+// BoundedList2, and the list it writes to must not be freed under it, even
+// once it has left the ring buffer.
+bool test_rotation_does_not_wait() {
+  std::cout << "Testing rotation does not wait for writers" << std::endl;
+
+  BoundedList2<Stalling> list(1000, 4);
+  Stalling::stall = true;
+  std::thread stuck([&list]() { list.prepend(Stalling(UINT64_MAX)); });
+  while (!Stalling::entered) {
+    std::this_thread::yield();
+  }
+  // Six rotations, the first two lists are evicted
+  for (uint64_t i = 0; i < 60; ++i) {
+    list.prepend(Stalling(i));
+  }
+  bool rotated = !Stalling::timed_out;
+  size_t freedWhileStuck = list.clearTrash();
+  Stalling::release = true;
+  stuck.join();
+  size_t freedAfterwards = list.clearTrash();
+
+  size_t count = 0;
+  list.forItems([&count](Stalling const &) { ++count; });
+  // The stuck writer holds back the epoch, so neither evicted list can be
+  // freed before it has left.
+  if (!rotated || freedWhileStuck != 0 || freedAfterwards != 2 ||
+      count != 40) {
+    std::cout << "Rotation waited for a stuck writer or freed its list, "
+              << freedWhileStuck << " freed while stuck" << std::endl;
+    return false;
+  }
+
+  std::cout << "Rotation does not wait test passed" << std::endl;
+  return true;
+}
+
+// While a writer is stuck on a rotated out list, the newer lists are
+// hidden from the cursor iteration, but not from plain forItems.
+bool test_hidden_lists() {
+  std::cout << "Testing hidden lists" << std::endl;
+
+  BoundedList2<Stalling> list(1000, 4);
+  Stalling::entered = false;
+  Stalling::release = false;
+  Stalling::timed_out = false;
+  Stalling::stall = true;
+  std::thread stuck([&list]() { list.prepend(Stalling(UINT64_MAX)); });
+  while (!Stalling::entered) {
+    std::this_thread::yield();
+  }
+  // The first list is full and rotated, the second one holds five items
+  for (uint64_t i = 0; i < 15; ++i) {
+    list.prepend(Stalling(i));
+  }
+  size_t all = 0;
+  list.forItems([&all](Stalling const &) { ++all; });
+  size_t visible = 0;
+  list.forItems(0, SIZE_MAX, [&visible](uint64_t, Stalling const &) {
+    ++visible;
+    return true;
+  });
+  Stalling::release = true;
+  stuck.join();
+  size_t visibleAfterwards = 0;
+  list.forItems(0, SIZE_MAX, [&](uint64_t, Stalling const &) {
+    ++visibleAfterwards;
+    return true;
+  });
+
+  if (Stalling::timed_out || all != 15 || visible != 10 ||
+      visibleAfterwards != 16) {
+    std::cout << "Unexpected visibility, " << all << " items in all, "
+              << visible << " and " << visibleAfterwards << " visible"
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Hidden lists test passed" << std::endl;
+  return true;
+}
+
+// A writer which fills up a generation of ShardedBoundedList, but is
+// delayed until another thread has rotated it, must not rotate the next,
+// still empty generation as well.
+bool test_late_writer_rotation() {
+  std::cout << "Testing late writer rotation" << std::endl;
+
+  // One shard, every item is a fold quantum and four fill a generation
+  ShardedBoundedList<Stalling, false, ThreadMetrics> list(400, 4, 1);
+  Stalling::entered = false;
+  Stalling::release = false;
+  Stalling::timed_out = false;
+  Stalling::stall = true;
+  std::thread late([&list]() { list.prepend(Stalling(UINT64_MAX)); });
+  while (!Stalling::entered) {
+    std::this_thread::yield();
+  }
+  for (uint64_t i = 0; i < 4; ++i) {
+    list.prepend(Stalling(i));
+  }
+  uint64_t rotationsBefore = list.stats().rotations;
+  Stalling::release = true;
+  late.join();
+  uint64_t rotationsAfter = list.stats().rotations;
+
+  if (Stalling::timed_out || rotationsBefore != 1 || rotationsAfter != 1) {
+    std::cout << "Late writer rotated again, " << rotationsBefore
+              << " rotations before and " << rotationsAfter << " after it"
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Late writer rotation test passed" << std::endl;
+  return true;
+}
+
+// Once the ring is full, exactly the newest `capacity` entries are kept.
+bool test_ring_overwrite() {
+  std::cout << "Testing ring overwrite" << std::endl;
+
+  RingBoundedList<Record> ring(100);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    ring.prepend(Record(0, i));
+  }
+  uint64_t expected = 1000;
+  bool ordered = true;
+  ring.forItems([&](Record const &record) {
+    ordered = ordered && record.seq + 1 == expected;
+    --expected;
+  });
+  if (ring.capacity() != 128 || !ordered || expected != 1000 - 128) {
+    std::cout << "Ring did not keep the newest entries" << std::endl;
+    return false;
+  }
+  std::cout << "Ring overwrite test passed" << std::endl;
+  return true;
+}
+
+// With ThreadMetrics every rotation and every freed list and node is
+// counted, and lists are either in the ring, in the trash or freed.
+template <typename ListType> bool test_metrics(char const *name) {
+  std::cout << "Testing metrics on " << name << std::endl;
+
+  ListType list(10 * sizeof(Record), 2);
+  for (uint64_t i = 0; i < 100; ++i) {
+    list.prepend(Record(0, i));
+  }
+  size_t freed = 0;
+  size_t step;
+  while ((step = list.reclaimStep(3)) > 0) {
+    freed += step;
+  }
+  ListHistoryStats stats = list.stats();
+  std::cout << "Rotations: " << stats.rotations
+            << ", lists freed: " << stats.lists_freed
+            << ", nodes freed: " << stats.nodes_freed
+            << ", retained: " << stats.retained_bytes << " bytes"
+            << std::endl;
+  if (stats.rotations < 3 ||
+      stats.lists_freed + stats.pending_lists + stats.max_history !=
+          stats.rotations ||
+      stats.nodes_freed != freed ||
+      stats.retained_bytes != list.memoryUsage() - stats.pending_bytes ||
+      stats.memory_threshold != 10 * sizeof(Record)) {
+    std::cout << "Unexpected metrics" << std::endl;
+    return false;
+  }
+
+  std::cout << "Metrics test on " << name << " passed" << std::endl;
+  return true;
+}
+
+// A log entry with a string, encoded without a temporary copy.
+struct LogEntry {
+  uint64_t id;
+  std::string path;
+
+  LogEntry(uint64_t id, std::string path) : id(id), path(std::move(path)) {}
+  size_t memoryUsage() const { return sizeof(LogEntry) + path.size(); }
+  size_t binarySize() const { return sizeof(id) + path.size(); }
+  void writeBinary(unsigned char *out) const {
+    std::memcpy(out, &id, sizeof(id));
+    std::memcpy(out + sizeof(id), path.data(), path.size());
+  }
+};
+
+// Padding bytes are not exported, such types have to encode themselves.
+struct Padded {
+  uint64_t id;
+  uint8_t flags;
+};
+static_assert(!BinaryExportable<Padded>);
+static_assert(RawExportable<Record>);
+
+// Item whose encoding does not fit into the 32 bit length of the export.
+struct Oversized {
+  std::string payload; // not trivially copyable, so binarySize is used
+  size_t binarySize() const { return size_t{UINT32_MAX} + 1; }
+  void writeBinary(unsigned char *) const {}
+};
+
+// The binary export delivers what forItems delivers, one batch per list,
+// and a reused buffer keeps its memory.
+template <template <typename, bool, typename> class ListType>
+bool test_export(char const *name) {
+  std::cout << "Testing binary export on " << name << std::endl;
+
+  ListType<Record, false, NoMetrics> records(10 * sizeof(Record), 4);
+  for (uint64_t i = 0; i < 35; ++i) {
+    records.prepend(Record(0, i));
+  }
+  std::vector<uint64_t> expected;
+  records.forItems([&expected](Record const &r) { expected.push_back(r.seq); });
+
+  ExportBuffer buffer;
+  uint64_t cursor = records.exportItems(buffer);
+  std::vector<uint64_t> exported;
+  bool intact = true;
+  ExportBuffer::forEach(buffer.bytes(), [&](uint64_t, auto bytes) {
+    Record r(0, 0);
+    intact = intact && bytes.size() == sizeof(Record);
+    std::memcpy(&r, bytes.data(), sizeof(Record));
+    exported.push_back(r.seq);
+  });
+  size_t streamed = 0;
+  for (iovec const &v : buffer.iovecs()) {
+    streamed += v.iov_len;
+  }
+  if (!intact || exported != expected || buffer.batches() < 2 ||
+      buffer.iovecs().size() != buffer.batches() ||
+      streamed != buffer.size()) {
+    std::cout << "Export does not match the items, " << exported.size()
+              << " of " << expected.size() << " in " << buffer.batches()
+              << " batches" << std::endl;
+    return false;
+  }
+
+  // Polling with the cursor only exports new items, into the same memory.
+  unsigned char const *memory = buffer.data();
+  records.prepend(Record(0, 35));
+  records.prepend(Record(0, 36));
+  records.exportItems(buffer, cursor);
+  if (buffer.items() != 2 || buffer.data() != memory ||
+      records.exportItems(buffer, cursor, 1) != cursor + 2 ||
+      buffer.items() != 1) {
+    std::cout << "Unexpected export after the cursor" << std::endl;
+    return false;
+  }
+
+  ListType<LogEntry, false, NoMetrics> entries(1024 * 1024, 4);
+  entries.prepend(LogEntry(7, "/_api/version"));
+  entries.exportItems(buffer);
+  std::string path;
+  uint64_t id = 0;
+  ExportBuffer::forEach(buffer.bytes(), [&](uint64_t, auto bytes) {
+    std::memcpy(&id, bytes.data(), sizeof(id));
+    path.assign(reinterpret_cast<char const *>(bytes.data()) + sizeof(id),
+                bytes.size() - sizeof(id));
+  });
+  if (id != 7 || path != "/_api/version") {
+    std::cout << "Unexpected log entry " << id << " " << path << std::endl;
+    return false;
+  }
+
+  // Truncated or corrupted exports are rejected without delivering items.
+  records.exportItems(buffer);
+  std::vector<unsigned char> corrupt(buffer.data(),
+                                     buffer.data() + buffer.size());
+  size_t delivered = 0;
+  auto count = [&delivered](uint64_t, auto) { ++delivered; };
+  bool truncated = ExportBuffer::forEach(
+      std::span(corrupt).first(corrupt.size() - 1), count);
+  // A byte of the length of the first item, behind the batch header and
+  // the sequence number, which makes it larger than the batch
+  corrupt[2 * sizeof(uint32_t) + sizeof(uint64_t) + 2] = 0xff;
+  bool overlong = ExportBuffer::forEach(corrupt, count);
+  if (truncated || overlong || delivered != 0 ||
+      !ExportBuffer::forEach(buffer.bytes(), count)) {
+    std::cout << "Malformed export was decoded" << std::endl;
+    return false;
+  }
+
+  // An item of 4 GiB is rejected before anything is written
+  bool rejected = false;
+  buffer.clear();
+  buffer.beginBatch();
+  try {
+    buffer.append(1, Oversized());
+  } catch (std::length_error const &) {
+    rejected = true;
+  }
+  buffer.endBatch();
+  if (!rejected || buffer.size() != 0) {
+    std::cout << "Item of 4 GiB was not rejected" << std::endl;
+    return false;
+  }
+
+  std::cout << "Binary export test on " << name << " passed" << std::endl;
+  return true;
+}
+
+// Minimal coroutine type which runs eagerly and cleans up after itself.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Writers keep prepending while a coroutine waits for the rotations so far
+// to settle, it must be resumed by the background reclaimer.
+bool test_rotation_settled() {
+  std::cout << "Testing coroutine wait for rotations" << std::endl;
+
+  BoundedList2<Record, false, ThreadMetrics> list(10 * sizeof(Record), 4);
+  list.startReclaimer();
+  std::atomic<bool> stop(false);
+  std::thread writer([&]() {
+    for (uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+      list.prepend(Record(0, i));
+    }
+  });
+  while (list.stats().rotations < 10) {
+    std::this_thread::yield();
+  }
+  std::atomic<int> settled(0);
+  auto waiter = [&]() -> Detached {
+    co_await list.rotationSettled();
+    settled.fetch_add(1);
+  };
+  for (int i = 0; i < 10; ++i) {
+    waiter();
+  }
+  for (int i = 0; i < 1000 && settled.load() < 10; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  stop.store(true, std::memory_order_relaxed);
+  writer.join();
+  list.stopReclaimer();
+  if (settled.load() != 10) {
+    std::cout << "Only " << settled.load() << " waiters were resumed"
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Coroutine wait for rotations test passed" << std::endl;
+  return true;
+}
+
+int main() {
+  bool ok = test_single_writer<BoundedList<Record>>("BoundedList") &&
+            test_single_writer<BoundedList2<Record>>("BoundedList2") &&
+            test_single_writer<ShardedBoundedList<Record>>(
+                "ShardedBoundedList") &&
+            test_concurrent_writers<BoundedList<Record>>("BoundedList") &&
+            test_concurrent_writers<BoundedList2<Record>>("BoundedList2") &&
+            test_concurrent_writers<ShardedBoundedList<Record>>(
+                "ShardedBoundedList") &&
+            test_paginated_iteration<BoundedList<Record>>("BoundedList") &&
+            test_paginated_iteration<BoundedList2<Record>>("BoundedList2") &&
+            test_concurrent_poll<BoundedList<Record>>("BoundedList") &&
+            test_concurrent_poll<BoundedList2<Record>>("BoundedList2") &&
+            test_exact_accounting<BoundedList<Record>>("BoundedList") &&
+            test_exact_accounting<BoundedList2<Record>>("BoundedList2") &&
+            test_batch_prepend<BoundedList<Record>>("BoundedList") &&
+            test_batch_prepend<BoundedList2<Record>>("BoundedList2") &&
+            test_batch_prepend<BoundedList2<Record, true>>(
+                "BoundedList2 (arena)") &&
+            test_trash_during_snapshot<BoundedList<Record>>("BoundedList") &&
+            test_trash_during_snapshot<BoundedList2<Record>>("BoundedList2") &&
+            test_trash_during_snapshot<ShardedBoundedList<Record>>(
+                "ShardedBoundedList") &&
+            test_incremental_reclaim<BoundedList<Record>>("BoundedList") &&
+            test_incremental_reclaim<BoundedList2<Record>>("BoundedList2") &&
+            test_incremental_reclaim<ShardedBoundedList<Record>>(
+                "ShardedBoundedList") &&
+            test_metrics<BoundedList<Record, false, ThreadMetrics>>(
+                "BoundedList") &&
+            test_metrics<BoundedList2<Record, false, ThreadMetrics>>(
+                "BoundedList2") &&
+            test_metrics<ShardedBoundedList<Record, false, ThreadMetrics>>(
+                "ShardedBoundedList") &&
+            test_export<BoundedList>("BoundedList") &&
+            test_export<BoundedList2>("BoundedList2") &&
+            test_rotation_settled() && test_rotation_does_not_wait() &&
+            test_hidden_lists() && test_late_writer_rotation() &&
+            test_arena_destruction() &&
+            test_single_writer<BoundedList2<Record, true>>(
+                "BoundedList2 (arena)") &&
+            test_concurrent_writers<BoundedList<Record, true>>(
+                "BoundedList (arena)") &&
+            test_concurrent_writers<BoundedList2<Record, true>>(
+                "BoundedList2 (arena)") &&
+            test_concurrent_writers<ShardedBoundedList<Record, true>>(
+                "ShardedBoundedList (arena)") &&
+            test_single_writer<RingBoundedList<Record>>("RingBoundedList") &&
+            test_concurrent_writers<RingBoundedList<Record>>(
+                "RingBoundedList") &&
+            test_ring_overwrite();
+  return ok ? 0 : 1;
+}
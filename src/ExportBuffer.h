@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#endif
+
+// Binary encoding of the items of a BoundedList for `exportItems`. Types
+// which are trivially copyable and have no padding are exported as their
+// object representation, padding bytes would leak whatever was in memory.
+// Other types (e.g. with padding or floating point members) provide
+//   size_t binarySize() const;            // number of bytes written
+//   void writeBinary(unsigned char *out) const;
+// which writes exactly `binarySize()` bytes, e.g. the characters of a
+// string member straight out of the item, without any temporary string.
+template <typename T>
+concept RawExportable = std::is_trivially_copyable_v<T> &&
+                        std::has_unique_object_representations_v<T>;
+
+template <typename T>
+concept BinaryExportable =
+    RawExportable<T> || requires(T const &item, unsigned char *out) {
+      { item.binarySize() } -> std::same_as<size_t>;
+      item.writeBinary(out);
+    };
+
+// The class ExportBuffer is the reusable output of `exportItems`. Its memory
+// is kept between exports, so once it has grown to the size of a typical
+// snapshot, exporting allocates nothing at all.
+// The format is compact and length-prefixed, in host byte order. Each list
+// of the history (newest first) which contributes items is one batch:
+//   uint32_t items; uint32_t bytes;   // batch header, bytes after it
+//   items times:
+//     uint64_t seq; uint32_t length;  // item header
+//     length bytes                    // the encoded item
+// A batch is contiguous, so `iovecs()` describes the export as one entry
+// per batch, ready for `writev` or `sendmsg`. `forEach` decodes an export.
+// Since the lengths have 32 bits, a list whose items take more than 4 GiB
+// is split into several batches, and a single larger item is rejected.
+class ExportBuffer {
+  std::unique_ptr<unsigned char[]> _data;
+  size_t _size = 0;
+  size_t _capacity = 0;
+  size_t _items = 0;
+  uint32_t _batchItems = 0;
+  std::vector<size_t> _batches; // offsets of the batch headers
+#if defined(__unix__) || defined(__APPLE__)
+  std::vector<iovec> _iovecs;
+#endif
+
+  static constexpr size_t BATCH_HEADER = 2 * sizeof(uint32_t);
+  static constexpr size_t ITEM_HEADER = sizeof(uint64_t) + sizeof(uint32_t);
+  static constexpr size_t MAX_BATCH_BYTES = UINT32_MAX;
+
+  // Returns room for `bytes` more bytes at the end. Growing copies what has
+  // been written so far, but does not initialize the new memory.
+  unsigned char *extend(size_t bytes) {
+    if (_size + bytes > _capacity) {
+      size_t capacity = std::max({_capacity * 2, _size + bytes, size_t{4096}});
+      std::unique_ptr<unsigned char[]> data(new unsigned char[capacity]);
+      if (_size > 0) {
+        std::memcpy(data.get(), _data.get(), _size);
+      }
+      _data = std::move(data);
+      _capacity = capacity;
+    }
+    unsigned char *out = _data.get() + _size;
+    _size += bytes;
+    return out;
+  }
+
+  template <typename V> static void store(unsigned char *out, V value) {
+    std::memcpy(out, &value, sizeof(V));
+  }
+
+  template <typename V> static V load(unsigned char const *in) {
+    V value;
+    std::memcpy(&value, in, sizeof(V));
+    return value;
+  }
+
+public:
+  // Forget the contents, but keep the memory.
+  void clear() noexcept {
+    _size = 0;
+    _items = 0;
+    _batches.clear();
+  }
+
+  // Start a new batch, which has to be closed with `endBatch` before the
+  // next one is started.
+  void beginBatch() {
+    _batches.push_back(_size);
+    _batchItems = 0;
+    extend(BATCH_HEADER);
+  }
+
+  // Append one item with its sequence number to the open batch, or to a new
+  // one if the open batch would exceed 4 GiB. Throws std::length_error if
+  // the item alone does not fit into a batch.
+  template <BinaryExportable T> void append(uint64_t seq, T const &item) {
+    size_t length;
+    if constexpr (RawExportable<T>) {
+      length = sizeof(T);
+    } else {
+      length = item.binarySize();
+    }
+    if (length > MAX_BATCH_BYTES - ITEM_HEADER) {
+      throw std::length_error("ExportBuffer: item larger than 4 GiB");
+    }
+    if (_size - _batches.back() - BATCH_HEADER >
+        MAX_BATCH_BYTES - ITEM_HEADER - length) {
+      endBatch();
+      beginBatch();
+    }
+    unsigned char *out = extend(ITEM_HEADER + length);
+    store(out, seq);
+    store(out + sizeof(uint64_t), static_cast<uint32_t>(length));
+    out += ITEM_HEADER;
+    if constexpr (RawExportable<T>) {
+      std::memcpy(out, &item, sizeof(T));
+    } else {
+      item.writeBinary(out);
+    }
+    ++_items;
+    ++_batchItems;
+  }
+
+  // Close the open batch. A batch without items is dropped.
+  void endBatch() {
+    size_t start = _batches.back();
+    if (_batchItems == 0) {
+      _size = start;
+      _batches.pop_back();
+      return;
+    }
+    size_t bytes = _size - start - BATCH_HEADER;
+    store(_data.get() + start, _batchItems);
+    store(_data.get() + start + sizeof(uint32_t),
+          static_cast<uint32_t>(bytes));
+  }
+
+  unsigned char const *data() const noexcept { return _data.get(); }
+  size_t size() const noexcept { return _size; }
+  size_t items() const noexcept { return _items; }
+  size_t batches() const noexcept { return _batches.size(); }
+  std::span<unsigned char const> bytes() const noexcept {
+    return {_data.get(), _size};
+  }
+
+#if defined(__unix__) || defined(__APPLE__)
+  // One entry per batch, valid until the buffer is changed.
+  std::span<iovec const> iovecs() {
+    _iovecs.clear();
+    for (size_t i = 0; i < _batches.size(); ++i) {
+      size_t end = i + 1 < _batches.size() ? _batches[i + 1] : _size;
+      _iovecs.push_back(iovec{_data.get() + _batches[i], end - _batches[i]});
+    }
+    return _iovecs;
+  }
+#endif
+
+  // Tells if `data` is a well formed export: every batch header and item
+  // header lies within the data, every item within its batch, and the item
+  // counts match.
+  static bool valid(std::span<unsigned char const> data) noexcept {
+    size_t offset = 0;
+    while (offset < data.size()) {
+      if (data.size() - offset < BATCH_HEADER) {
+        return false;
+      }
+      size_t items = load<uint32_t>(data.data() + offset);
+      size_t bytes = load<uint32_t>(data.data() + offset + sizeof(uint32_t));
+      offset += BATCH_HEADER;
+      if (bytes > data.size() - offset) {
+        return false;
+      }
+      size_t end = offset + bytes;
+      for (; offset < end; --items) {
+        if (items == 0 || end - offset < ITEM_HEADER) {
+          return false;
+        }
+        size_t length =
+            load<uint32_t>(data.data() + offset + sizeof(uint64_t));
+        offset += ITEM_HEADER;
+        if (length > end - offset) {
+          return false;
+        }
+        offset += length;
+      }
+      if (items != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Decode an export: calls `callback(seq, bytes)` for every item, in the
+  // order in which they were exported. The bytes point into `data`. Data
+  // which is not `valid`, e.g. truncated on the way, is rejected as a whole:
+  // then no item is delivered and false is returned.
+  template <typename F>
+    requires std::is_invocable_v<F, uint64_t, std::span<unsigned char const>>
+  static bool forEach(std::span<unsigned char const> data, F &&callback) {
+    if (!valid(data)) {
+      return false;
+    }
+    size_t offset = 0;
+    while (offset < data.size()) {
+      size_t end = offset + BATCH_HEADER +
+                   load<uint32_t>(data.data() + offset + sizeof(uint32_t));
+      offset += BATCH_HEADER;
+      while (offset < end) {
+        uint64_t seq = load<uint64_t>(data.data() + offset);
+        size_t length = load<uint32_t>(data.data() + offset + sizeof(seq));
+        offset += ITEM_HEADER;
+        callback(seq, data.subspan(offset, length));
+        offset += length;
+      }
+    }
+    return true;
+  }
+};
@@ -0,0 +1,405 @@
+#pragma once
+
+#include "ResourceManager.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Reclamation with hazard pointers, for `ResourceManager<T, Metrics,
+// HazardDomain>`. Instead of an epoch, every read publishes the pointer it
+// is about to use in a slot of its own (its hazard), and a retired resource
+// can be freed as soon as no slot holds its address. So a reader which holds
+// an old version for a long time only keeps that one version alive, while
+// newer retirements are freed as usual: the garbage is bounded by the number
+// of slots, not by the slowest reader.
+// The price is on the read side: a read claims a slot with a
+// compare-exchange (nested reads claim one each, since each protects its own
+// pointer), and protecting the pointer needs a full fence and a reload.
+// A read which finds all slots taken probes until one is released, so there
+// have to be more slots than reads, nested ones included, at any time.
+// The retire epoch handed out by `update()` is a ticket which identifies
+// the old resource, so `wait_reclaim(epoch)` and `try_reclaim(epoch)` only
+// wait for the readers of that resource, not for all older ones.
+// Of the ResourceManagerOptions, `epoch_slots` is the number of hazard
+// slots, and `slot_assignment` and `slot_logger` work as for EpochDomain.
+// The read protocol and the NUMA options do not apply and are ignored.
+template <typename Metrics = NoMetrics> class HazardDomain {
+  template <typename, typename, template <typename> class>
+  friend class ResourceManager;
+
+  // A slot is free (0), claimed by a reader which protects nothing yet (or
+  // a nullptr), or holds the address which its reader protects.
+  static constexpr uintptr_t CLAIMED = 1;
+
+  struct alignas(64) HazardSlot {
+    std::atomic<uintptr_t> hazard{0};
+  };
+  using Slot = HazardSlot;
+
+  // The managers look at these to decide about pointer replicas.
+  static constexpr bool replicate = false;
+  static constexpr size_t numa_nodes = 1;
+
+  const size_t num_slots;
+  const SlotAssignment slot_assignment;
+  const SlotLogger slot_logger;
+  std::unique_ptr<HazardSlot[]> slots;
+
+  // Tickets handed out as retire epochs, starting at 1 like the epochs.
+  std::atomic<uint64_t> next_ticket{1};
+
+  // Retirements and tickets whose resource might still be protected. Both
+  // are pruned with a single scan of the slots. `pending` is what
+  // `try_reclaim()` looks at, so it also has entries for resources which
+  // were handed back to the caller of `update()` instead of being retired.
+  struct Retired {
+    void const *address;
+    std::unique_ptr<void, void (*)(void *)> resource;
+  };
+  struct Ticket {
+    uint64_t ticket;
+    void const *address;
+  };
+  std::mutex limbo_mutex;
+  std::vector<Retired> limbo;
+  std::vector<Ticket> pending;
+
+  // Threads parked in `wait_reclaim()`, see EpochDomain.
+  std::atomic<uint32_t> reclaim_waiters{0};
+  std::atomic<uint32_t> release_seq{0};
+
+  static constexpr int RECLAIM_SPINS = 128;
+  static constexpr std::chrono::nanoseconds MAX_PARK =
+      std::chrono::milliseconds(1);
+
+  using Clock = std::chrono::steady_clock;
+
+  [[no_unique_address]] typename Metrics::template Counters<ManagerCounter>
+      metrics;
+
+  // Claim a slot for a read: probe from the thread's preferred slot until a
+  // compare-exchange from 0 succeeds.
+  HazardSlot *enter_read() {
+    size_t index = slot_assignment == SlotAssignment::Registered
+                       ? ThreadIndex::dense()
+                       : ThreadIndex::ordinal();
+    size_t const preferred_slot = index < num_slots ? index : index % num_slots;
+    size_t slot = preferred_slot;
+    [[maybe_unused]] uint64_t probes = 0;
+    while (true) {
+      uintptr_t expected = 0;
+      if (slots[slot].hazard.compare_exchange_strong(
+              expected, CLAIMED, std::memory_order_relaxed,
+              std::memory_order_relaxed)) {
+        if (slot != preferred_slot && slot_logger != nullptr) [[unlikely]] {
+          slot_logger(preferred_slot, slot);
+        }
+        metrics.add(ManagerCounter::Reads);
+        if (probes > 0) {
+          metrics.add(ManagerCounter::SlotCollisions);
+          metrics.add(ManagerCounter::ProbeSteps, probes);
+          metrics.maximum(ManagerCounter::MaxProbe, probes);
+        }
+        return &slots[slot];
+      }
+      ++probes;
+      slot = slot + 1 < num_slots ? slot + 1 : 0;
+    }
+  }
+
+  // Load the pointer to read from `source` and publish it in the slot. The
+  // pointer is only safe to use if it is still current after the hazard is
+  // visible, otherwise a writer might have scanned the slots in between.
+  template <typename P>
+  P *protect(HazardSlot *slot, std::atomic<P *> const &source) const {
+    P *resource = source.load(std::memory_order_acquire);
+    while (true) {
+      slot->hazard.store(resource != nullptr
+                             ? reinterpret_cast<uintptr_t>(resource)
+                             : CLAIMED,
+                         std::memory_order_relaxed);
+      // The store of the hazard must not be reordered with the reload. This
+      // pairs with the fence in `hazards()`.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      P *current = source.load(std::memory_order_acquire);
+      if (current == resource) {
+        return resource;
+      }
+      resource = current;
+    }
+  }
+
+  void leave_read(HazardSlot *slot) {
+    // This synchronizes with the loads in `hazards()`: the reads of the
+    // resource happen before it is freed.
+    slot->hazard.store(0, std::memory_order_release);
+    if (reclaim_waiters.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+      release_seq.fetch_add(1, std::memory_order_release);
+      Futex::wake_all(release_seq);
+    }
+  }
+
+  // Scan all slots once and return the protected addresses, sorted.
+  std::vector<uintptr_t> hazards() {
+    metrics.add(ManagerCounter::SlotScans);
+    // The pointer swaps of all retirements so far have to be ordered before
+    // the loads of the slots, see `protect()`.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::vector<uintptr_t> result;
+    for (size_t i = 0; i < num_slots; ++i) {
+      uintptr_t hazard = slots[i].hazard.load(std::memory_order_acquire);
+      if (hazard > CLAIMED) {
+        result.push_back(hazard);
+      }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  static bool is_protected(std::vector<uintptr_t> const &hazards,
+                           void const *address) {
+    return std::binary_search(hazards.begin(), hazards.end(),
+                              reinterpret_cast<uintptr_t>(address));
+  }
+
+  // Drop the tickets of resources which are not protected. The caller must
+  // hold limbo_mutex.
+  void prune_pending_locked(std::vector<uintptr_t> const &hazards) {
+    std::erase_if(pending, [&hazards](Ticket const &t) {
+      return !is_protected(hazards, t.address);
+    });
+  }
+
+  // Draw the ticket for a resource which a manager has just swapped out.
+  // Once the pointer is no longer current, readers which protect it later
+  // fail their validation, so only the slots which hold it now matter.
+  uint64_t advance(void const *retired) {
+    uint64_t ticket = next_ticket.fetch_add(1, std::memory_order_acq_rel);
+    if (retired == nullptr) {
+      return ticket;
+    }
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    pending.push_back(Ticket{ticket, retired});
+    // Callers which never ask about their tickets must not make the list
+    // grow without bound. At most `num_slots` resources are protected.
+    if (pending.size() > 2 * num_slots) {
+      prune_pending_locked(hazards());
+    }
+    return ticket;
+  }
+
+  bool wait_reclaim_until(uint64_t epoch,
+                          std::optional<Clock::time_point> deadline) {
+    Clock::time_point start;
+    if constexpr (Metrics::template Counters<ManagerCounter>::enabled) {
+      start = Clock::now();
+    }
+    bool reclaimable = false;
+    for (int i = 0; i < RECLAIM_SPINS && !reclaimable; ++i) {
+      reclaimable = try_reclaim(epoch);
+      if (!reclaimable) {
+        cpu_relax();
+      }
+    }
+    if (!reclaimable) {
+      reclaim_waiters.fetch_add(1, std::memory_order_seq_cst);
+      while (true) {
+        uint32_t seq = release_seq.load(std::memory_order_acquire);
+        if (try_reclaim(epoch)) {
+          reclaimable = true;
+          break;
+        }
+        auto park = MAX_PARK;
+        if (deadline) {
+          auto now = Clock::now();
+          if (now >= *deadline) {
+            break;
+          }
+          park = std::min<std::chrono::nanoseconds>(park, *deadline - now);
+        }
+        metrics.add(ManagerCounter::ReclaimParks);
+        Futex::wait(release_seq, seq, park);
+      }
+      reclaim_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if constexpr (Metrics::template Counters<ManagerCounter>::enabled) {
+      metrics.add(ManagerCounter::ReclaimWaits);
+      metrics.add(ManagerCounter::ReclaimWaitNs,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count());
+    }
+    return reclaimable;
+  }
+
+public:
+  explicit HazardDomain(ResourceManagerOptions options = {})
+      : num_slots(options.epoch_slots),
+        slot_assignment(options.slot_assignment),
+        slot_logger(options.slot_logger),
+        slots(new HazardSlot[num_slots]) {
+    if (num_slots == 0) {
+      throw std::invalid_argument(
+          "ResourceManager: epoch_slots must be > 0");
+    }
+  }
+
+  // No reader may be left, the remaining retired resources are freed.
+  ~HazardDomain() = default;
+
+  HazardDomain(const HazardDomain &) = delete;
+  HazardDomain &operator=(const HazardDomain &) = delete;
+
+  // Wait until no reader protects the resource retired with `epoch`.
+  void wait_reclaim(uint64_t epoch) { wait_reclaim_until(epoch, std::nullopt); }
+
+  // Like `wait_reclaim()`, but gives up after `timeout`. Returns true if
+  // the resource is reclaimable.
+  template <typename Rep, typename Period>
+  bool wait_reclaim_for(uint64_t epoch,
+                        std::chrono::duration<Rep, Period> timeout) {
+    return wait_reclaim_until(epoch, Clock::now() + timeout);
+  }
+
+  // Returns true if the resource retired with `epoch` can no longer be seen
+  // by any reader. Does not block. Unlike with EpochDomain, this says
+  // nothing about resources retired earlier.
+  bool try_reclaim(uint64_t epoch) {
+    if (epoch >= next_ticket.load(std::memory_order_acquire)) {
+      return false;
+    }
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    auto it = std::find_if(pending.begin(), pending.end(),
+                           [epoch](Ticket const &t) {
+                             return t.ticket == epoch;
+                           });
+    if (it == pending.end()) {
+      return true;
+    }
+    if (is_protected(hazards(), it->address)) {
+      return false;
+    }
+    pending.erase(it);
+    return true;
+  }
+
+  // Hand a resource which was returned by `update()` of any manager of the
+  // domain over to deferred reclamation. It is freed by a later call to
+  // `reclaim()` once no reader protects it.
+  template <typename T>
+  void retire(std::unique_ptr<T> resource, uint64_t) {
+    if (resource == nullptr) {
+      return;
+    }
+    void const *address = resource.get();
+    std::unique_ptr<void, void (*)(void *)> erased(
+        resource.release(),
+        [](void *resource) { delete static_cast<T *>(resource); });
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    limbo.push_back(Retired{address, std::move(erased)});
+  }
+
+  // Free all retired resources which no reader protects, with a single scan
+  // of the slots. A reader which holds an old resource only keeps that one
+  // in the limbo list. Returns the number of resources which were freed.
+  size_t reclaim() {
+    size_t freed = reclaim_limbo();
+    awaiters.resume([this](uint64_t epoch) { return try_reclaim(epoch); });
+    return freed;
+  }
+
+  // Coroutine variant of `wait_reclaim()`: `co_await domain.reclaimed(epoch)`
+  // suspends the coroutine until no reader protects the resource of
+  // `epoch` any more. It is resumed by the next `reclaim()` which finds the
+  // epoch reclaimable, or by the background reclaimer, and continues on
+  // that thread.
+  ReclaimAwaiters::Awaitable<HazardDomain> reclaimed(uint64_t epoch) {
+    return {this, &awaiters, epoch};
+  }
+
+  // Start a background thread which waits for the epochs of suspended
+  // coroutines and resumes them (and frees retired resources meanwhile).
+  // Without coroutines waiting it looks every `poll` for retired resources.
+  void start_reclaimer(std::chrono::nanoseconds poll = MAX_PARK) {
+    awaiters.start(
+        [this](uint64_t epoch, std::chrono::nanoseconds timeout) {
+          wait_reclaim_for(epoch, timeout);
+        },
+        [this]() { reclaim(); }, poll);
+  }
+
+  void stop_reclaimer() { awaiters.stop(); }
+
+private:
+  // The freeing part of `reclaim()`.
+  size_t reclaim_limbo() {
+    std::vector<Retired> ready;
+    {
+      std::lock_guard<std::mutex> guard(limbo_mutex);
+      if (limbo.empty()) {
+        return 0;
+      }
+      std::vector<uintptr_t> protected_addresses = hazards();
+      auto it = std::partition(limbo.begin(), limbo.end(),
+                               [&protected_addresses](Retired const &r) {
+                                 return is_protected(protected_addresses,
+                                                     r.address);
+                               });
+      ready.assign(std::make_move_iterator(it),
+                   std::make_move_iterator(limbo.end()));
+      limbo.erase(it, limbo.end());
+      prune_pending_locked(protected_addresses);
+    }
+    // The actual deallocation happens outside of the lock.
+    return ready.size();
+  }
+
+public:
+  // Number of retired resources which are still waiting to be freed.
+  size_t pending_retirements() {
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    return limbo.size();
+  }
+
+  // Counters (if metrics are enabled) and the backlog. `global_epoch` is
+  // the next ticket and `min_active_epoch` the oldest ticket which might
+  // still be protected.
+  ResourceManagerStats stats() {
+    ResourceManagerStats result;
+    result.reads = metrics.total(ManagerCounter::Reads);
+    result.slot_collisions = metrics.total(ManagerCounter::SlotCollisions);
+    result.probe_steps = metrics.total(ManagerCounter::ProbeSteps);
+    result.max_probe = metrics.max(ManagerCounter::MaxProbe);
+    result.slot_scans = metrics.total(ManagerCounter::SlotScans);
+    result.reclaim_waits = metrics.total(ManagerCounter::ReclaimWaits);
+    result.reclaim_wait_ns = metrics.total(ManagerCounter::ReclaimWaitNs);
+    result.reclaim_parks = metrics.total(ManagerCounter::ReclaimParks);
+    result.global_epoch = next_ticket.load(std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> guard(limbo_mutex);
+      result.min_active_epoch = result.global_epoch;
+      for (Ticket const &t : pending) {
+        result.min_active_epoch = std::min(result.min_active_epoch, t.ticket);
+      }
+      result.pending_retirements = limbo.size();
+    }
+    result.epoch_slots = num_slots;
+    result.numa_nodes = numa_nodes;
+    return result;
+  }
+
+  // Reads always claim their slot with a compare-exchange.
+  ReadProtocol protocol() const { return ReadProtocol::CompareExchange; }
+
+private:
+  // Coroutines suspended in `reclaimed()`, and the background reclaimer.
+  // Declared last, so the reclaimer is stopped before anything else goes.
+  ReclaimAwaiters awaiters;
+};
@@ -0,0 +1,15 @@
+// Second translation unit of resource_manager_test, which includes every
+// header once more. The library is header-only, so linking it with the
+// test fails if a header defines something which is not inline.
+#include "AtomicList.h"
+#include "BoundedList.h"
+#include "BoundedList2.h"
+#include "ExportBuffer.h"
+#include "HazardDomain.h"
+#include "LatencyHistogram.h"
+#include "ListHistory.h"
+#include "QuiescentDomain.h"
+#include "RWLockResourceManager.h"
+#include "ResourceManager.h"
+#include "RingBoundedList.h"
+#include "ShardedBoundedList.h"
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+// The class LatencyHistogram records latencies in nanoseconds in
+// logarithmic buckets, in the spirit of HdrHistogram: values below 32 are
+// counted exactly, and every power of two above is split into 32 linear
+// sub-buckets, so every recorded value is known with a relative error of
+// at most 1/32. The whole range of uint64_t fits into 1920 counters.
+// A histogram is meant to be owned by a single thread, so recording is a
+// plain increment without any synchronization. The histograms of all
+// threads are merged once they have finished.
+class LatencyHistogram {
+public:
+  static constexpr unsigned SUB_BUCKET_BITS = 5;
+  static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+  static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  void record(uint64_t value) noexcept {
+    ++counts[index(value)];
+    ++total;
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+  }
+
+  void record(double value) noexcept {
+    record(static_cast<uint64_t>(std::llround(std::max(value, 0.0))));
+  }
+
+  void merge(LatencyHistogram const &other) noexcept {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+  }
+
+  uint64_t count() const noexcept { return total; }
+
+  double mean() const noexcept {
+    return total == 0 ? 0.0 : static_cast<double>(sum) / total;
+  }
+
+  uint64_t max_value() const noexcept { return total == 0 ? 0 : max; }
+
+  // Value below which the fraction `percentile` of all values lies, as the
+  // highest value of its bucket, but at most the largest value recorded.
+  double percentile(double percentile) const noexcept {
+    if (total == 0) {
+      return 0.0;
+    }
+    auto rank = static_cast<uint64_t>(std::ceil(percentile * total));
+    rank = std::clamp<uint64_t>(rank, 1, total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return static_cast<double>(std::clamp(highest(i), min, max));
+      }
+    }
+    return static_cast<double>(max);
+  }
+
+private:
+  static size_t index(uint64_t value) noexcept {
+    if (value < SUB_BUCKETS) {
+      return value;
+    }
+    unsigned exponent = std::bit_width(value) - 1;
+    unsigned shift = exponent - SUB_BUCKET_BITS;
+    size_t group = shift + 1;
+    return (group << SUB_BUCKET_BITS) + ((value >> shift) - SUB_BUCKETS);
+  }
+
+  static uint64_t highest(size_t index) noexcept {
+    size_t group = index >> SUB_BUCKET_BITS;
+    uint64_t sub = index & (SUB_BUCKETS - 1);
+    if (group == 0) {
+      return sub;
+    }
+    uint64_t lowest = (SUB_BUCKETS + sub) << (group - 1);
+    return lowest + ((uint64_t{1} << (group - 1)) - 1);
+  }
+
+  std::array<uint64_t, BUCKETS> counts{};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t min = std::numeric_limits<uint64_t>::max();
+  uint64_t max = 0;
+};
@@ -0,0 +1,473 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ExportBuffer.h"
+#include "ResourceManager.h"
+
+// Counters of a ListHistory with metrics enabled.
+enum class ListCounter {
+  Rotations,  // calls of `rotate`
+  ListsFreed, // lists freed from the trash
+  NodesFreed, // nodes freed by `reclaimStep`
+  COUNT
+};
+
+// Snapshot of the state of a bounded list, see `stats()`. The counters are
+// 0 unless metrics are enabled, the gauges are always filled in.
+struct ListHistoryStats {
+  uint64_t rotations = 0;
+  uint64_t lists_freed = 0;
+  uint64_t nodes_freed = 0;
+
+  size_t retained_bytes = 0; // current and historic lists
+  size_t pending_bytes = 0;  // lists in the trash
+  size_t pending_lists = 0;
+  size_t max_history = 0;
+  size_t memory_threshold = 0; // filled in by the bounded lists
+};
+
+// Pacing of the optional background reclaimer of a ListHistory.
+struct TrashReclaimerOptions {
+  // Nodes freed per step, bounds the time of a single step
+  size_t nodes_per_step = 4096;
+  // Pause between two steps while there is work
+  std::chrono::microseconds pause{100};
+  // Interval for rechecking the trash when there is no work
+  std::chrono::milliseconds idle{10};
+};
+
+// The class ListHistory implements the ring buffer of historic lists which
+// is shared by the bounded lists. Besides the ring itself it maintains an
+// immutable "view": an array of raw pointers to the current list and all
+// historic lists, newest first, which is published through a
+// ResourceManager. Readers pin the view and traverse the lists without
+// taking the mutex and without allocating anything, only a rotation
+// allocates a new view. Lists which fall out of the ring are moved to the
+// trash, tagged with the retire epoch of the last view which referenced
+// them, and are only freed once no reader can still hold such a view.
+// A bounded list which does not wait for its writers to leave the old
+// current list before it rotates it into the ring can pass the epoch of
+// its writers to `rotate`, together with a predicate to the constructor
+// which tells if all writers of that epoch have left. The list is then
+// also only freed once this holds.
+// Freeing happens either all at once in `clearTrash`, or in slices of a
+// bounded number of nodes with `reclaimStep`, which an optional background
+// thread (`startReclaimer`) calls paced by TrashReclaimerOptions. Lists are
+// freed outside of the mutex, so neither rotation nor readers wait for it.
+// Rotation (`rotate`) must be done by one thread at a time, which the
+// bounded lists ensure with their _isRotating flag.
+// With `Metrics = ThreadMetrics` rotations and freed lists and nodes are
+// counted, see `stats()`.
+// The lists are numbered by generations and the sequence numbers of the
+// items in a list start at `listSeq(generation)`, so sequence numbers grow
+// monotonically over all lists in the order in which forLists visits them,
+// provided no list ever holds more than 2^40 items.
+// A list in the ring which writers might still prepend to hides all newer
+// lists from the cursor paths (`forItems(since, ...)` and `exportItems`),
+// until its writers have left (or it is evicted). A reader which continues
+// after the largest sequence number it has seen so far thus never skips an
+// item which lands in an older list later on. forLists shows all lists.
+// The writers are those of the epoch given to `rotate`.
+template <typename List, typename Metrics = NoMetrics> class ListHistory {
+private:
+  struct View {
+    std::vector<List *> lists; // newest first
+    // Index of the oldest list which might still be written to, the cursor
+    // paths start there and the lists before it are hidden from them
+    size_t first = 0;
+  };
+
+  struct Entry {
+    std::shared_ptr<List> list;
+    uint64_t writersEpoch = 0; // 0 means no writers to wait for
+    // No writer will prepend any more, cached under _mutex
+    mutable bool quiesced = false;
+  };
+
+  struct TrashEntry {
+    uint64_t epoch;
+    uint64_t writersEpoch;
+    std::shared_ptr<List> list;
+    size_t bytes; // memory usage of the list when it was evicted
+  };
+
+  // Published view for lock-free readers
+  mutable ResourceManager<View> _views;
+
+  // Ring buffer for historic lists
+  std::vector<Entry> _history;
+  size_t _ringBufferPos;
+  std::vector<TrashEntry> _trash;
+
+  // Mutex for protecting the ring buffer and trash
+  mutable std::mutex _mutex;
+
+  // Lists which no reader can reach any more, being freed slice by slice
+  std::vector<TrashEntry> _reclaiming;
+  std::mutex _reclaimMutex;
+
+  std::atomic<size_t> _pendingBytes{0};
+  std::atomic<size_t> _pendingLists{0};
+
+  [[no_unique_address]] typename Metrics::template Counters<ListCounter>
+      _metrics;
+
+  const std::size_t _maxHistory;
+
+  // Tells if all writers of an epoch given to `rotate` have left
+  std::function<bool(uint64_t)> _writersLeft;
+
+  // Generation of the newest list, only touched by the rotating thread
+  uint64_t _generation = 1;
+
+  // Current list of the published view, protected by _mutex
+  List *_current;
+  // Tells if the published view hides lists, see `refreshView`
+  mutable std::atomic<bool> _hiding{false};
+
+  // Background reclaimer, _evicted is protected by _wakeMutex
+  std::mutex _wakeMutex;
+  std::condition_variable_any _wake;
+  bool _evicted = false;
+  std::jthread _reclaimer;
+
+  // Tells if no writer can still prepend to the list of a ring entry, needs
+  // _mutex. Once it holds it is remembered.
+  bool quiesced(Entry const &entry) const {
+    if (!entry.quiesced) {
+      entry.quiesced =
+          entry.writersEpoch == 0 || _writersLeft(entry.writersEpoch);
+    }
+    return entry.quiesced;
+  }
+
+  // Index in the view of the oldest list in the ring which might still be
+  // written to, 0 if there is none, needs _mutex.
+  size_t firstVisible() const {
+    size_t index = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < _maxHistory; ++i) {
+      size_t pos = (_ringBufferPos + _maxHistory - 1 - i) % _maxHistory;
+      Entry const &entry = _history[pos];
+      if (entry.list != nullptr) {
+        ++count;
+        if (!quiesced(entry)) {
+          index = count;
+        }
+      }
+    }
+    return index;
+  }
+
+  // Build the view of the current list and the ring, needs _mutex.
+  std::unique_ptr<View> makeView() const {
+    auto view = std::make_unique<View>();
+    view->lists.reserve(_maxHistory + 1);
+    view->lists.push_back(_current);
+    for (size_t i = 0; i < _maxHistory; ++i) {
+      size_t pos = (_ringBufferPos + _maxHistory - 1 - i) % _maxHistory;
+      if (_history[pos].list != nullptr) {
+        view->lists.push_back(_history[pos].list.get());
+      }
+    }
+    view->first = firstVisible();
+    _hiding.store(view->first != 0, std::memory_order_relaxed);
+    return view;
+  }
+
+  // Publish a view which shows the lists hidden so far once the writers of
+  // the older lists have left. Readers call this before they pin the view,
+  // it does nothing while another thread holds _mutex.
+  void refreshView() const {
+    std::unique_lock<std::mutex> guard(_mutex, std::try_to_lock);
+    if (!guard.owns_lock()) {
+      return;
+    }
+    size_t first = _views.read([](View const &view) { return view.first; });
+    if (firstVisible() != first) {
+      _views.update_deferred(makeView());
+    }
+  }
+
+  // Visit the lists like forLists, or with `visibleOnly` only those which
+  // are not hidden from the cursor paths.
+  template <typename F> void visitLists(bool visibleOnly, F &&f) const {
+    if (visibleOnly && _hiding.load(std::memory_order_relaxed)) [[unlikely]] {
+      refreshView();
+    }
+    auto view = _views.pin();
+    for (size_t i = visibleOnly ? view->first : 0; i < view->lists.size();
+         ++i) {
+      List *list = view->lists[i];
+      if constexpr (std::is_same_v<std::invoke_result_t<F &, List &>, bool>) {
+        if (!f(*list)) {
+          return;
+        }
+      } else {
+        f(*list);
+      }
+    }
+  }
+
+  // Move the trash entries which no reader can reach any more to
+  // _reclaiming, needs _reclaimMutex.
+  void collectReady() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    std::erase_if(_trash, [this](TrashEntry &trash) {
+      if (!_views.try_reclaim(trash.epoch) ||
+          (trash.writersEpoch != 0 && !_writersLeft(trash.writersEpoch))) {
+        return false;
+      }
+      _reclaiming.push_back(std::move(trash));
+      return true;
+    });
+  }
+
+  void forget(TrashEntry const &entry) {
+    _metrics.add(ListCounter::ListsFreed);
+    _pendingBytes.fetch_sub(entry.bytes, std::memory_order_relaxed);
+    _pendingLists.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+public:
+  static constexpr unsigned LIST_SEQ_BITS = 40;
+
+  // First sequence number of the list of the given generation, the initial
+  // list has generation 1.
+  static constexpr uint64_t listSeq(uint64_t generation) {
+    return generation << LIST_SEQ_BITS;
+  }
+
+  // First sequence number for the next new list, only for the rotating
+  // thread.
+  uint64_t nextListSeq() { return listSeq(++_generation); }
+
+  // Number of yields a writer which found its list full waits at most for
+  // the rotation by another thread, see `awaitRotation`.
+  static constexpr unsigned ROTATION_BACKOFF_YIELDS = 64;
+
+  // Lets a writer which found its list full back off while another thread
+  // rotates it, instead of prepending further to the full list. The wait is
+  // capped, so a rotating thread which is preempted does not stall the
+  // writers: they go on after ROTATION_BACKOFF_YIELDS yields, and only then
+  // overshoot the threshold by more than a prepend each.
+  static void awaitRotation(std::atomic<bool> const &isRotating) noexcept {
+    for (unsigned i = 0; i < ROTATION_BACKOFF_YIELDS &&
+                         isRotating.load(std::memory_order_acquire);
+         ++i) {
+      std::this_thread::yield();
+    }
+  }
+
+  ListHistory(std::size_t maxHistory, List *current,
+              std::function<bool(uint64_t)> writersLeft = {})
+      : _views(std::make_unique<View>(View{{current}})),
+        _history(maxHistory), _ringBufferPos(0), _maxHistory(maxHistory),
+        _writersLeft(std::move(writersLeft)), _current(current) {}
+
+  ~ListHistory() { stopReclaimer(); }
+
+  // Move the previous current list into the ring and publish a new view
+  // with `newCurrent` in front. If `writersEpoch` is not 0, writers might
+  // still prepend to `oldCurrent` until the predicate given to the
+  // constructor returns true for it, and the newer lists stay hidden from
+  // the cursor paths until then.
+  void rotate(std::shared_ptr<List> oldCurrent, List *newCurrent,
+              uint64_t writersEpoch = 0) {
+    _metrics.add(ListCounter::Rotations);
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+
+      // Move the old current list into the ring buffer
+      auto toDelete = std::move(_history[_ringBufferPos]);
+      _history[_ringBufferPos] = Entry{std::move(oldCurrent), writersEpoch};
+      _ringBufferPos = (_ringBufferPos + 1) % _maxHistory;
+      _current = newCurrent;
+
+      // Readers of older views might still traverse the evicted list
+      uint64_t epoch = _views.update_deferred(makeView());
+
+      // Schedule the old list for deletion
+      if (toDelete.list == nullptr) {
+        return;
+      }
+      size_t bytes = toDelete.list->memoryUsage();
+      _pendingBytes.fetch_add(bytes, std::memory_order_relaxed);
+      _pendingLists.fetch_add(1, std::memory_order_relaxed);
+      _trash.push_back(TrashEntry{epoch, toDelete.writersEpoch,
+                                  std::move(toDelete.list), bytes});
+    }
+    {
+      std::lock_guard<std::mutex> guard(_wakeMutex);
+      _evicted = true;
+    }
+    _wake.notify_one();
+  }
+
+  // Call `f` for the current and all historic lists from newest to oldest.
+  // The lists stay valid during the whole iteration. If `f` returns a bool,
+  // returning false stops the iteration.
+  template <typename F> void forLists(F &&f) const {
+    visitLists(false, std::forward<F>(f));
+  }
+
+  // The bounded iteration and the export of the bounded lists, which are
+  // documented there. Both stop at the first item which is not newer than
+  // `since` and return the largest sequence number they have seen.
+  template <typename F>
+  uint64_t forItems(uint64_t since, size_t limit, F &&callback) const {
+    uint64_t cursor = since;
+    size_t count = 0;
+    visitLists(true, [&](List const &list) {
+      auto *node = list.getSnapshot();
+      // Sequence numbers are dense, only the head stores its own
+      uint64_t seq = node != nullptr ? node->_seq : 0;
+      for (; node != nullptr; node = node->next(), --seq) {
+        if (seq <= since || count == limit || !callback(seq, node->_data)) {
+          return false;
+        }
+        cursor = std::max(cursor, seq);
+        ++count;
+      }
+      return true;
+    });
+    return cursor;
+  }
+
+  uint64_t exportItems(ExportBuffer &buffer, uint64_t since,
+                       size_t limit) const {
+    buffer.clear();
+    uint64_t cursor = since;
+    size_t count = 0;
+    visitLists(true, [&](List const &list) {
+      bool more = true;
+      buffer.beginBatch();
+      auto *node = list.getSnapshot();
+      uint64_t seq = node != nullptr ? node->_seq : 0;
+      for (; node != nullptr; node = node->next(), --seq) {
+        if (seq <= since || count == limit) {
+          more = false;
+          break;
+        }
+        buffer.append(seq, node->_data);
+        cursor = std::max(cursor, seq);
+        ++count;
+      }
+      buffer.endBatch();
+      return more;
+    });
+    return cursor;
+  }
+
+  size_t clearTrash() {
+    // This method is called by a cleanup thread to free old batches.
+    // Returns the number of batches that were freed.
+    std::lock_guard<std::mutex> guard(_reclaimMutex);
+    collectReady();
+    size_t freedBatches = _reclaiming.size();
+    for (auto const &entry : _reclaiming) {
+      forget(entry);
+    }
+    _reclaiming.clear();
+    return freedBatches;
+  }
+
+  // Free at most about `maxNodes` nodes of lists in the trash which no
+  // reader can reach any more. Returns the number of nodes freed, which is
+  // less than `maxNodes` if there is no more work for now.
+  size_t reclaimStep(size_t maxNodes) {
+    std::lock_guard<std::mutex> guard(_reclaimMutex);
+    collectReady();
+    size_t freed = 0;
+    while (freed < maxNodes && !_reclaiming.empty()) {
+      TrashEntry &entry = _reclaiming.back();
+      // A writer of BoundedList might still hold a reference to a very old
+      // current list. Then it is freed when the writer lets go of it.
+      if (entry.list.use_count() == 1) {
+        freed += entry.list->releaseNodes(maxNodes - freed);
+        if (!entry.list->empty()) {
+          break;
+        }
+      }
+      forget(entry);
+      _reclaiming.pop_back();
+    }
+    _metrics.add(ListCounter::NodesFreed, freed);
+    return freed;
+  }
+
+  // Memory usage of the current and all historic lists, hidden or not.
+  size_t retainedBytes() const {
+    size_t bytes = 0;
+    auto view = _views.pin();
+    for (List const *list : view->lists) {
+      bytes += list->memoryUsage();
+    }
+    return bytes;
+  }
+
+  // Memory and number of lists in the trash which are not yet freed.
+  size_t pendingBytes() const noexcept {
+    return _pendingBytes.load(std::memory_order_relaxed);
+  }
+  size_t pendingLists() const noexcept {
+    return _pendingLists.load(std::memory_order_relaxed);
+  }
+
+  // Counters (if metrics are enabled) and the current memory usage.
+  ListHistoryStats stats() const {
+    ListHistoryStats result;
+    result.rotations = _metrics.total(ListCounter::Rotations);
+    result.lists_freed = _metrics.total(ListCounter::ListsFreed);
+    result.nodes_freed = _metrics.total(ListCounter::NodesFreed);
+    result.retained_bytes = retainedBytes();
+    result.pending_bytes = pendingBytes();
+    result.pending_lists = pendingLists();
+    result.max_history = _maxHistory;
+    return result;
+  }
+
+  // Start a background thread which frees the trash with `reclaimStep`.
+  // Does nothing if it already runs. Must not race with stopReclaimer.
+  void startReclaimer(TrashReclaimerOptions options = {}) {
+    if (_reclaimer.joinable()) {
+      return;
+    }
+    _reclaimer = std::jthread([this, options](std::stop_token stop) {
+      std::unique_lock<std::mutex> lock(_wakeMutex);
+      while (!stop.stop_requested()) {
+        lock.unlock();
+        size_t freed = reclaimStep(options.nodes_per_step);
+        lock.lock();
+        if (freed >= options.nodes_per_step) {
+          // More work to do, give the CPU to others for a moment
+          _wake.wait_for(lock, stop, options.pause, [] { return false; });
+        } else {
+          // Wait for a rotation to evict a list, retry from time to time
+          // for lists which were still pinned by readers
+          _wake.wait_for(lock, stop, options.idle,
+                         [this] { return _evicted; });
+          _evicted = false;
+        }
+      }
+    });
+  }
+
+  void stopReclaimer() {
+    if (_reclaimer.joinable()) {
+      _reclaimer.request_stop();
+      _reclaimer.join();
+    }
+  }
+};
@@ -0,0 +1,385 @@
+#pragma once
+
+#include "ResourceManager.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Quiescent state based reclamation, for `ResourceManager<T, Metrics,
+// QuiescentDomain>`. Reads do not announce anything, they are a plain load
+// of the pointer. Instead, every reading thread joins the domain as a
+// participant and reports quiescent states, points in its code where it
+// holds no resource of the domain, e.g. between two requests. A resource
+// retired with epoch r is freed once every online participant has passed a
+// quiescent state after r. Threads which do not read for a while go offline
+// and are not waited for.
+// This suits threads with a natural loop, like request handlers, and makes
+// reads as cheap as they can get. The price is that a participant which
+// does not report quiescent states holds up the reclamation of all
+// resources of the domain, and that
+//  - reads are only allowed for online participants of the domain,
+//  - and a participant must not wait for reclamation (`wait_reclaim()`,
+//    and thus the destructor of a manager) while it is online.
+// Of the ResourceManagerOptions, `epoch_slots` is the maximum number of
+// participants and `slot_assignment` selects their preferred slot. The read
+// protocol and the NUMA options do not apply and are ignored.
+template <typename Metrics = NoMetrics> class QuiescentDomain {
+  template <typename, typename, template <typename> class>
+  friend class ResourceManager;
+
+  // The epoch of the last quiescent state of the participant which owns the
+  // slot, 0 while it is offline.
+  struct alignas(64) ParticipantSlot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> joined{false};
+  };
+  using Slot = ParticipantSlot;
+
+  // The managers look at these to decide about pointer replicas.
+  static constexpr bool replicate = false;
+  static constexpr size_t numa_nodes = 1;
+
+  std::atomic<uint64_t> global_epoch{1};
+  // Cached result of the last slot scan, see EpochDomain.
+  std::atomic<uint64_t> min_active_epoch{1};
+
+  struct Retired {
+    uint64_t epoch;
+    std::unique_ptr<void, void (*)(void *)> resource;
+  };
+  std::mutex limbo_mutex;
+  std::vector<Retired> limbo;
+
+  const size_t num_slots;
+  const SlotAssignment slot_assignment;
+  std::unique_ptr<ParticipantSlot[]> slots;
+
+  // Threads parked in `wait_reclaim()`: participants which see a non-zero
+  // count when they report a quiescent state wake them.
+  std::atomic<uint32_t> reclaim_waiters{0};
+  std::atomic<uint32_t> release_seq{0};
+
+  static constexpr int RECLAIM_SPINS = 128;
+  static constexpr std::chrono::nanoseconds MAX_PARK =
+      std::chrono::milliseconds(1);
+
+  using Clock = std::chrono::steady_clock;
+
+  [[no_unique_address]] typename Metrics::template Counters<ManagerCounter>
+      metrics;
+
+  // Reads are covered by the participant's slot, see `join()`.
+  ParticipantSlot *enter_read() { return nullptr; }
+  void leave_read(ParticipantSlot *) {}
+
+  template <typename P>
+  P *protect(ParticipantSlot *, std::atomic<P *> const &source) const {
+    return source.load(std::memory_order_acquire);
+  }
+
+  uint64_t advance(void const *) {
+    return global_epoch.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  void wake_waiters() {
+    if (reclaim_waiters.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+      release_seq.fetch_add(1, std::memory_order_release);
+      Futex::wake_all(release_seq);
+    }
+  }
+
+  // Scan all slots once and return the oldest epoch which some online
+  // participant might still be reading.
+  uint64_t scan_min_active_epoch() {
+    metrics.add(ManagerCounter::SlotScans);
+    uint64_t min_epoch = global_epoch.load(std::memory_order_acquire);
+    // Pairs with the fence in `Participant::online()`.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (size_t i = 0; i < num_slots; ++i) {
+      uint64_t slot_epoch = slots[i].epoch.load(std::memory_order_acquire);
+      if (slot_epoch != 0 && slot_epoch < min_epoch) {
+        min_epoch = slot_epoch;
+      }
+    }
+    return min_epoch;
+  }
+
+  uint64_t refresh_min_active_epoch() {
+    uint64_t scanned = scan_min_active_epoch();
+    uint64_t cached = min_active_epoch.load(std::memory_order_relaxed);
+    while (cached < scanned &&
+           !min_active_epoch.compare_exchange_weak(cached, scanned,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+    }
+    return std::max(cached, scanned);
+  }
+
+  bool wait_reclaim_until(uint64_t epoch,
+                          std::optional<Clock::time_point> deadline) {
+    Clock::time_point start;
+    if constexpr (Metrics::template Counters<ManagerCounter>::enabled) {
+      start = Clock::now();
+    }
+    bool reclaimable = false;
+    for (int i = 0; i < RECLAIM_SPINS && !reclaimable; ++i) {
+      reclaimable = try_reclaim(epoch);
+      if (!reclaimable) {
+        cpu_relax();
+      }
+    }
+    if (!reclaimable) {
+      reclaim_waiters.fetch_add(1, std::memory_order_seq_cst);
+      while (true) {
+        uint32_t seq = release_seq.load(std::memory_order_acquire);
+        if (try_reclaim(epoch)) {
+          reclaimable = true;
+          break;
+        }
+        auto park = MAX_PARK;
+        if (deadline) {
+          auto now = Clock::now();
+          if (now >= *deadline) {
+            break;
+          }
+          park = std::min<std::chrono::nanoseconds>(park, *deadline - now);
+        }
+        metrics.add(ManagerCounter::ReclaimParks);
+        Futex::wait(release_seq, seq, park);
+      }
+      reclaim_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if constexpr (Metrics::template Counters<ManagerCounter>::enabled) {
+      metrics.add(ManagerCounter::ReclaimWaits);
+      metrics.add(ManagerCounter::ReclaimWaitNs,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count());
+    }
+    return reclaimable;
+  }
+
+public:
+  explicit QuiescentDomain(ResourceManagerOptions options = {})
+      : num_slots(options.epoch_slots),
+        slot_assignment(options.slot_assignment),
+        slots(new ParticipantSlot[num_slots]) {
+    if (num_slots == 0) {
+      throw std::invalid_argument(
+          "ResourceManager: epoch_slots must be > 0");
+    }
+  }
+
+  // No participant may be left, the remaining retired resources are freed.
+  ~QuiescentDomain() = default;
+
+  QuiescentDomain(const QuiescentDomain &) = delete;
+  QuiescentDomain &operator=(const QuiescentDomain &) = delete;
+
+  // Registration of a reading thread, see `join()`. It has to be used and
+  // destroyed on the thread which joined.
+  class Participant {
+    friend class QuiescentDomain;
+
+    QuiescentDomain *domain;
+    ParticipantSlot *slot;
+
+    Participant(QuiescentDomain *domain, ParticipantSlot *slot)
+        : domain(domain), slot(slot) {
+      online();
+    }
+
+  public:
+    Participant(const Participant &) = delete;
+    Participant &operator=(const Participant &) = delete;
+
+    ~Participant() {
+      offline();
+      slot->joined.store(false, std::memory_order_release);
+    }
+
+    // Report that the thread holds no resource of the domain right now.
+    // Everything retired before is no longer waited for. Unless the epoch
+    // has moved on since the last one, this is only a load. Only allowed
+    // while online.
+    void quiescent() {
+      // The acquire synchronizes with `advance()`, so reads after this see
+      // the pointers of all retirements below the epoch. The release makes
+      // the reads before this happen before the frees.
+      uint64_t epoch = domain->global_epoch.load(std::memory_order_acquire);
+      if (slot->epoch.load(std::memory_order_relaxed) != epoch) {
+        slot->epoch.store(epoch, std::memory_order_release);
+        domain->wake_waiters();
+      }
+    }
+
+    // Stop reading for a while, e.g. before blocking. The thread must not
+    // read until it calls `online()`, and it may wait for reclamation.
+    void offline() {
+      slot->epoch.store(0, std::memory_order_release);
+      domain->wake_waiters();
+    }
+
+    // Resume reading after `offline()`.
+    void online() {
+      slot->epoch.store(domain->global_epoch.load(std::memory_order_acquire),
+                        std::memory_order_relaxed);
+      // The store must not be reordered with the loads of the resources
+      // which follow. Pairs with the fence in `scan_min_active_epoch()`.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+  };
+
+  // Register the calling thread as an online participant. Throws
+  // std::runtime_error if all `epoch_slots` slots are taken.
+  Participant join() {
+    size_t index = slot_assignment == SlotAssignment::Registered
+                       ? ThreadIndex::dense()
+                       : ThreadIndex::ordinal();
+    size_t const preferred_slot = index < num_slots ? index : index % num_slots;
+    for (size_t i = 0; i < num_slots; ++i) {
+      size_t slot = preferred_slot + i < num_slots
+                        ? preferred_slot + i
+                        : preferred_slot + i - num_slots;
+      bool expected = false;
+      if (slots[slot].joined.compare_exchange_strong(
+              expected, true, std::memory_order_acquire,
+              std::memory_order_relaxed)) {
+        return Participant(this, &slots[slot]);
+      }
+    }
+    throw std::runtime_error("QuiescentDomain: no free participant slot");
+  }
+
+  // Wait until every online participant has passed a quiescent state after
+  // `epoch`. Must not be called by an online participant.
+  void wait_reclaim(uint64_t epoch) { wait_reclaim_until(epoch, std::nullopt); }
+
+  // Like `wait_reclaim()`, but gives up after `timeout`. Returns true if
+  // the epoch is reclaimable.
+  template <typename Rep, typename Period>
+  bool wait_reclaim_for(uint64_t epoch,
+                        std::chrono::duration<Rep, Period> timeout) {
+    return wait_reclaim_until(epoch, Clock::now() + timeout);
+  }
+
+  // Returns true if a resource retired with `epoch` can no longer be seen by
+  // any participant. Does not block.
+  bool try_reclaim(uint64_t epoch) {
+    if (min_active_epoch.load(std::memory_order_acquire) > epoch) {
+      return true;
+    }
+    return refresh_min_active_epoch() > epoch;
+  }
+
+  // Hand a resource which was returned by `update()` of any manager of the
+  // domain over to deferred reclamation.
+  template <typename T>
+  void retire(std::unique_ptr<T> resource, uint64_t epoch) {
+    if (resource == nullptr) {
+      return;
+    }
+    std::unique_ptr<void, void (*)(void *)> erased(
+        resource.release(),
+        [](void *resource) { delete static_cast<T *>(resource); });
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    limbo.push_back(Retired{epoch, std::move(erased)});
+  }
+
+  // Free all retired resources which every online participant has passed
+  // by, with at most one scan of the slots. Returns the number of resources
+  // which were freed.
+  size_t reclaim() {
+    size_t freed = reclaim_limbo();
+    awaiters.resume([this](uint64_t epoch) { return try_reclaim(epoch); });
+    return freed;
+  }
+
+  // Coroutine variant of `wait_reclaim()`: `co_await domain.reclaimed(epoch)`
+  // suspends the coroutine until all online participants have passed
+  // `epoch`. It is resumed by the next `reclaim()` which finds the epoch
+  // reclaimable, or by the background reclaimer, and continues on that
+  // thread.
+  ReclaimAwaiters::Awaitable<QuiescentDomain> reclaimed(uint64_t epoch) {
+    return {this, &awaiters, epoch};
+  }
+
+  // Start a background thread which waits for the epochs of suspended
+  // coroutines and resumes them (and frees retired resources meanwhile).
+  // Without coroutines waiting it looks every `poll` for retired resources.
+  void start_reclaimer(std::chrono::nanoseconds poll = MAX_PARK) {
+    awaiters.start(
+        [this](uint64_t epoch, std::chrono::nanoseconds timeout) {
+          wait_reclaim_for(epoch, timeout);
+        },
+        [this]() { reclaim(); }, poll);
+  }
+
+  void stop_reclaimer() { awaiters.stop(); }
+
+private:
+  // The freeing part of `reclaim()`.
+  size_t reclaim_limbo() {
+    std::vector<Retired> ready;
+    {
+      std::lock_guard<std::mutex> guard(limbo_mutex);
+      if (limbo.empty()) {
+        return 0;
+      }
+      uint64_t min_epoch = min_active_epoch.load(std::memory_order_acquire);
+      uint64_t max_retired = 0;
+      for (auto const &r : limbo) {
+        max_retired = std::max(max_retired, r.epoch);
+      }
+      if (max_retired >= min_epoch) {
+        min_epoch = refresh_min_active_epoch();
+      }
+      auto it = std::partition(
+          limbo.begin(), limbo.end(),
+          [min_epoch](Retired const &r) { return r.epoch >= min_epoch; });
+      ready.assign(std::make_move_iterator(it),
+                   std::make_move_iterator(limbo.end()));
+      limbo.erase(it, limbo.end());
+    }
+    // The actual deallocation happens outside of the lock.
+    return ready.size();
+  }
+
+public:
+  // Number of retired resources which are still waiting to be freed.
+  size_t pending_retirements() {
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    return limbo.size();
+  }
+
+  // Counters (if metrics are enabled) and the current epochs and backlog.
+  // Reads are not counted, since they do not touch the domain.
+  ResourceManagerStats stats() {
+    ResourceManagerStats result;
+    result.slot_scans = metrics.total(ManagerCounter::SlotScans);
+    result.reclaim_waits = metrics.total(ManagerCounter::ReclaimWaits);
+    result.reclaim_wait_ns = metrics.total(ManagerCounter::ReclaimWaitNs);
+    result.reclaim_parks = metrics.total(ManagerCounter::ReclaimParks);
+    result.global_epoch = global_epoch.load(std::memory_order_relaxed);
+    result.min_active_epoch = min_active_epoch.load(std::memory_order_relaxed);
+    result.pending_retirements = pending_retirements();
+    result.epoch_slots = num_slots;
+    result.numa_nodes = numa_nodes;
+    return result;
+  }
+
+  // Reads do not announce, so there is no protocol to choose.
+  ReadProtocol protocol() const { return ReadProtocol::CompareExchange; }
+
+private:
+  // Coroutines suspended in `reclaimed()`, and the background reclaimer.
+  // Declared last, so the reclaimer is stopped before anything else goes.
+  ReclaimAwaiters awaiters;
+};
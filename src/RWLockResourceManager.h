@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+
+// Standard read-write lock based resource manager for comparison
+template <typename T> class RWLockResourceManager {
+private:
+  std::unique_ptr<T> resource;
+  mutable std::shared_mutex mutex;
+
+public:
+  explicit RWLockResourceManager(std::unique_ptr<T> initial_resource)
+      : resource(std::move(initial_resource)) {}
+
+  ~RWLockResourceManager() = default;
+
+  // Delete copy/move constructors and assignment operators
+  RWLockResourceManager(const RWLockResourceManager &) = delete;
+  RWLockResourceManager &operator=(const RWLockResourceManager &) = delete;
+  RWLockResourceManager(RWLockResourceManager &&) = delete;
+  RWLockResourceManager &operator=(RWLockResourceManager &&) = delete;
+
+  // Reader API: Get access to the resource
+  template <typename F>
+  auto read(F &&f) -> decltype(f(std::declval<const T &>())) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return f(*resource);
+  }
+
+  // Writer API: Update the resource
+  std::pair<std::unique_ptr<T>, uint64_t>
+  update(std::unique_ptr<T> new_resource) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    std::unique_ptr<T> old_resource = std::move(resource);
+    resource = std::move(new_resource);
+    return std::make_pair(std::move(old_resource), 0); // No epoch needed
+  }
+
+  // No-op for compatibility with ResourceManager API
+  void wait_reclaim(uint64_t) {}
+};
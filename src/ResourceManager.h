@@ -1,19 +1,42 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #if defined(__x86_64__) || defined(_M_X64)
 #include <emmintrin.h>
 #endif
-#include <iostream>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include <bit>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <optional>
-#include <random>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
-void cpu_relax() {
+// The library is header-only, so everything defined at namespace scope has
+// to be inline (or a template) to be included into several translation units.
+inline void cpu_relax() {
   // CPU hint for spin-waiting
 #if defined(__x86_64__) || defined(_M_X64)
   _mm_pause(); // x86 pause instruction
@@ -24,161 +47,1342 @@ void cpu_relax() {
 #endif
 }
 
-template <typename T> class ResourceManager {
+// Process-wide numbering of threads, used to map threads to epoch slots
+// deterministically. `ordinal()` is a ticket which is drawn on first use and
+// never reused. `dense()` is a small index which is given back when the
+// thread exits, so as long as at most N threads are alive at the same time,
+// they all have distinct dense indices below N (up to DENSE_INDICES threads,
+// beyond that we fall back to the ordinal). Both are lock-free and neither
+// does any I/O, diagnostics are only produced if a logger is installed.
+class ThreadIndex {
+public:
+  // Diagnostics hook, called once per thread when it is assigned an index of
+  // the given kind ("ordinal" or "dense"). Must be thread-safe.
+  using Logger = void (*)(char const *kind, size_t index);
+
 private:
-  // Alignment for cache line to prevent false sharing
-  struct alignas(64) EpochSlot {
-    std::atomic<uint64_t> epoch{0};
+  static constexpr size_t DENSE_WORDS = 64;
+  static inline std::atomic<size_t> next_ordinal{0};
+  static inline std::atomic<uint64_t> dense_bitmap[DENSE_WORDS]{};
+  static inline std::atomic<Logger> logger{nullptr};
+
+  static size_t log_assignment(char const *kind, size_t index) {
+    Logger log = logger.load(std::memory_order_acquire);
+    if (log != nullptr) {
+      log(kind, index);
+    }
+    return index;
+  }
+
+  static size_t acquire_dense() {
+    for (size_t w = 0; w < DENSE_WORDS; ++w) {
+      uint64_t bits = dense_bitmap[w].load(std::memory_order_relaxed);
+      while (bits != ~uint64_t{0}) {
+        int bit = std::countr_one(bits); // lowest free index in this word
+        if (dense_bitmap[w].compare_exchange_weak(
+                bits, bits | (uint64_t{1} << bit), std::memory_order_acquire,
+                std::memory_order_relaxed)) {
+          return w * 64 + bit;
+        }
+      }
+    }
+    return DENSE_INDICES + ordinal();
+  }
+
+  static void release_dense(size_t index) {
+    if (index < DENSE_INDICES) {
+      dense_bitmap[index / 64].fetch_and(~(uint64_t{1} << (index % 64)),
+                                         std::memory_order_release);
+    }
+  }
+
+  struct DenseRegistration {
+    size_t index;
+    DenseRegistration() : index(log_assignment("dense", acquire_dense())) {}
+    ~DenseRegistration() { release_dense(index); }
   };
 
-  // Resource management
-  std::atomic<T *> current_resource;
-  std::atomic<uint64_t> global_epoch{1}; // Start at 1, 0 means "not reading"
-  std::mutex writer_mutex;
+public:
+  static constexpr size_t DENSE_INDICES = DENSE_WORDS * 64;
+
+  static size_t ordinal() {
+    static thread_local size_t index = log_assignment(
+        "ordinal", next_ordinal.fetch_add(1, std::memory_order_relaxed));
+    return index;
+  }
+
+  static size_t dense() {
+    static thread_local DenseRegistration registration;
+    return registration.index;
+  }
+
+  // Install (or with nullptr remove) the diagnostics hook.
+  static void set_logger(Logger log) {
+    logger.store(log, std::memory_order_release);
+  }
+};
 
-  // Epoch slots for reader tracking
-  std::vector<EpochSlot> epoch_slots;
+// Asymmetric memory barrier: readers only issue a compiler barrier
+// (`light()`), and writers pay for ordering with a process-wide barrier
+// (`heavy()`) which forces a full memory barrier on every running thread of
+// the process. On Linux this is the `membarrier` system call, elsewhere (or
+// on kernels without it) `available()` returns false.
+struct AsymmetricFence {
+  static bool available() {
+#if defined(__linux__) && defined(__NR_membarrier)
+    static const bool registered =
+        syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+                0) == 0;
+    return registered;
+#else
+    return false;
+#endif
+  }
 
-  // Thread-local storage for slot index
-  static thread_local std::optional<size_t> thread_slot_index;
+  static void light() { std::atomic_signal_fence(std::memory_order_seq_cst); }
 
-  // Constants
-  static constexpr size_t EPOCH_SLOTS = 128;
+  static void heavy() {
+#if defined(__linux__) && defined(__NR_membarrier)
+    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+  }
+};
 
-  // Get the thread's slot index, initializing if needed
-  size_t get_thread_slot() {
-    if (!thread_slot_index) {
-      // Random initialization to distribute threads across slots
-      std::random_device rd;
-      std::mt19937 gen(rd());
-      std::uniform_int_distribution<size_t> dist(0, EPOCH_SLOTS - 1);
-      thread_slot_index = dist(gen);
-      std::cout << "Using slot " << thread_slot_index.value() << "\n";
+// Minimal futex wrapper to park a thread on a 32-bit word with a timeout,
+// which std::atomic::wait does not offer. Elsewhere this degrades to short
+// sleeps, and `wake_all()` does nothing.
+struct Futex {
+  static void wait(std::atomic<uint32_t> &word, uint32_t expected,
+                   std::chrono::nanoseconds timeout) {
+#if defined(__linux__) && defined(SYS_futex)
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+            FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+#else
+    if (word.load(std::memory_order_acquire) == expected) {
+      std::this_thread::sleep_for(
+          std::min<std::chrono::nanoseconds>(timeout,
+                                             std::chrono::microseconds(50)));
     }
-    return *thread_slot_index;
+#endif
+  }
+
+  static void wake_all(std::atomic<uint32_t> &word) {
+#if defined(__linux__) && defined(SYS_futex)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+            FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+};
+
+// Node of a thread as last told by the kernel, see NumaNode::current().
+struct NumaNodeCache {
+  size_t node = 0;
+  uint32_t countdown = 0;
+};
+
+// Constant initialization avoids a TLS init guard on every access.
+inline constinit thread_local NumaNodeCache numa_node_cache{};
+
+// NUMA topology as far as the managers need it: the number of nodes, the
+// node the calling thread runs on, and binding memory to a node. On Linux
+// this uses /sys, getcpu and mbind directly, so there is no dependency on
+// libnuma. Elsewhere there is a single node and binding does nothing.
+struct NumaNode {
+  // Size of a memory page, asked from the system once. Binding works on
+  // whole pages, so the blocks of `allocate` are aligned and sized by it.
+  static size_t page_size() {
+    static const size_t size = [] {
+#if defined(__linux__)
+      long result = sysconf(_SC_PAGESIZE);
+      if (result > 0) {
+        return static_cast<size_t>(result);
+      }
+#endif
+      return size_t{4096};
+    }();
+    return size;
+  }
+
+  // `bytes` rounded up to whole pages.
+  static size_t pages(size_t bytes) {
+    size_t page = page_size();
+    return (bytes + page - 1) / page * page;
+  }
+
+  struct PageDeleter {
+    void operator()(unsigned char *memory) const {
+      ::operator delete(memory, std::align_val_t{page_size()});
+    }
+  };
+  using Pages = std::unique_ptr<unsigned char[], PageDeleter>;
+
+  // Distance of the per-node blocks of `bytes` in `allocate`.
+  static size_t stride(size_t bytes, size_t nodes) {
+    return nodes == 1 ? bytes : pages(bytes);
+  }
+
+  // Allocate `nodes` blocks of `stride(bytes, nodes)` bytes, page aligned
+  // and with block i bound to node i. The memory is not initialized.
+  static Pages allocate(size_t bytes, size_t nodes) {
+    size_t block = stride(bytes, nodes);
+    Pages memory(static_cast<unsigned char *>(
+        ::operator new(block * nodes, std::align_val_t{page_size()})));
+    // Bind before the first touch, so the pages need not be moved:
+    if (nodes > 1) {
+      for (size_t node = 0; node < nodes; ++node) {
+        bind(memory.get() + node * block, block, node);
+      }
+    }
+    return memory;
+  }
+
+  // Number of configured nodes, at least 1.
+  static size_t count() {
+    static const size_t nodes = [] {
+      std::ifstream file("/sys/devices/system/node/possible");
+      std::string range; // e.g. "0" or "0-3"
+      if (!std::getline(file, range) || range.empty()) {
+        return size_t{1};
+      }
+      try {
+        return std::stoul(range.substr(range.find_last_of("-,") + 1)) + 1;
+      } catch (...) {
+        return size_t{1};
+      }
+    }();
+    return nodes;
+  }
+
+  // Node of the calling thread. The answer of the kernel is cached and only
+  // refreshed every REFRESH calls, so threads which migrate to another node
+  // move their reads there with a short delay.
+  static size_t current() {
+    NumaNodeCache &cache = numa_node_cache;
+    if (cache.countdown-- == 0) {
+      cache.countdown = REFRESH;
+      cache.node = query();
+    }
+    return cache.node;
+  }
+
+  // Node of the calling thread as of the last `current()`.
+  static size_t cached() { return numa_node_cache.node; }
+
+  // Ask the kernel to place the pages of [address, address + bytes) on
+  // `node`, moving pages which are already there. Best effort, failures are
+  // ignored, then the pages stay where first touch puts them.
+  static void bind(void *address, size_t bytes, size_t node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask[4] = {};
+    if (node >= sizeof(mask) * CHAR_BIT) {
+      return;
+    }
+    mask[node / (sizeof(long) * CHAR_BIT)] =
+        1UL << (node % (sizeof(long) * CHAR_BIT));
+    syscall(SYS_mbind, address, bytes, MPOL_PREFERRED, mask,
+            sizeof(mask) * CHAR_BIT, MPOL_MF_MOVE);
+#else
+    (void)address;
+    (void)bytes;
+    (void)node;
+#endif
+  }
+
+private:
+  static constexpr uint32_t REFRESH = 1024;
+
+  static size_t query() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+      return node;
+    }
+#endif
+    return 0;
+  }
+};
+
+// Per-thread record of the epoch domains (see EpochDomain) in which the
+// thread currently has an epoch announced, so nested reads of the same
+// manager, or of managers sharing a domain, reuse the outer announcement
+// instead of claiming another slot. A thread typically pins only a few
+// domains at a time, so a small array is searched linearly.
+struct ThreadPins {
+  static constexpr size_t CAPACITY = 8;
+
+  struct Pin {
+    void const *domain = nullptr;
+    void *slot = nullptr;
+    size_t depth = 0;
+  };
+
+  Pin pins[CAPACITY]{};
+  size_t count = 0;
+
+  Pin *find(void const *domain) {
+    for (size_t i = 0; i < count; ++i) {
+      if (pins[i].domain == domain) {
+        return &pins[i];
+      }
+    }
+    return nullptr;
+  }
+
+  bool full() const { return count == CAPACITY; }
+
+  void add(void const *domain, void *slot) {
+    pins[count++] = Pin{domain, slot, 1};
+  }
+
+  void remove(Pin *pin) { *pin = pins[--count]; }
+};
+
+// Constant initialization avoids a TLS init guard on every access.
+inline constinit thread_local ThreadPins thread_pins{};
+
+// Metrics policies. A component which supports runtime metrics takes one of
+// these as a template parameter and keeps a
+// `Metrics::Counters<Counter>` member, where `Counter` is an enum of its
+// counters ending in `COUNT`. With NoMetrics (the default) the member is
+// empty and every update compiles to nothing. With ThreadMetrics every
+// thread counts into a cache line of its own, selected by its dense thread
+// index, so counting is an uncontended relaxed increment, and `total()`
+// sums up all threads on demand.
+struct NoMetrics {
+  template <typename Counter> struct Counters {
+    static constexpr bool enabled = false;
+    void add(Counter, uint64_t = 1) noexcept {}
+    void maximum(Counter, uint64_t) noexcept {}
+    uint64_t total(Counter) const noexcept { return 0; }
+    uint64_t max(Counter) const noexcept { return 0; }
+  };
+};
+
+struct ThreadMetrics {
+  // Threads whose dense indices are equal modulo SHARDS share a shard, which
+  // is still correct, only slower.
+  static constexpr size_t SHARDS = 64;
+
+  template <typename Counter> class Counters {
+    static constexpr size_t COUNT = static_cast<size_t>(Counter::COUNT);
+
+    struct alignas(64) Shard {
+      std::atomic<uint64_t> values[COUNT]{};
+    };
+    std::unique_ptr<Shard[]> shards{new Shard[SHARDS]};
+
+    std::atomic<uint64_t> &value(Counter counter) noexcept {
+      return shards[ThreadIndex::dense() % SHARDS]
+          .values[static_cast<size_t>(counter)];
+    }
+
+  public:
+    static constexpr bool enabled = true;
+
+    void add(Counter counter, uint64_t n = 1) noexcept {
+      value(counter).fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Counters updated with `maximum` keep the largest value seen.
+    void maximum(Counter counter, uint64_t v) noexcept {
+      std::atomic<uint64_t> &current = value(counter);
+      uint64_t seen = current.load(std::memory_order_relaxed);
+      while (seen < v && !current.compare_exchange_weak(
+                             seen, v, std::memory_order_relaxed)) {
+      }
+    }
+
+    uint64_t total(Counter counter) const noexcept {
+      uint64_t sum = 0;
+      for (size_t i = 0; i < SHARDS; ++i) {
+        sum += shards[i].values[static_cast<size_t>(counter)].load(
+            std::memory_order_relaxed);
+      }
+      return sum;
+    }
+
+    uint64_t max(Counter counter) const noexcept {
+      uint64_t result = 0;
+      for (size_t i = 0; i < SHARDS; ++i) {
+        result = std::max(result,
+                          shards[i].values[static_cast<size_t>(counter)].load(
+                              std::memory_order_relaxed));
+      }
+      return result;
+    }
+  };
+};
+
+// Counters of a ResourceManager with metrics enabled.
+enum class ManagerCounter {
+  Reads,          // announcements, nested reads are not counted
+  SlotCollisions, // announcements which found their preferred slot busy
+  ProbeSteps,     // slots probed beyond the preferred one, in total
+  MaxProbe,       // longest probe (maximum)
+  SlotScans,      // scans of all epoch slots by writers
+  ReclaimWaits,   // calls of wait_reclaim and wait_reclaim_for
+  ReclaimWaitNs,  // time spent in them
+  ReclaimParks,   // times a waiter parked on the futex
+  COUNT
+};
+
+// Snapshot of the state of a ResourceManager, see `stats()`. The counters
+// are 0 unless metrics are enabled, the gauges are always filled in.
+struct ResourceManagerStats {
+  uint64_t reads = 0;
+  uint64_t slot_collisions = 0;
+  uint64_t probe_steps = 0;
+  uint64_t max_probe = 0;
+  uint64_t slot_scans = 0;
+  uint64_t reclaim_waits = 0;
+  uint64_t reclaim_wait_ns = 0;
+  uint64_t reclaim_parks = 0;
+
+  uint64_t global_epoch = 0;
+  uint64_t min_active_epoch = 0;
+  size_t pending_retirements = 0;
+  size_t epoch_slots = 0; // per NUMA node
+  size_t numa_nodes = 0;
+};
+
+// How a ResourceManager maps threads to their first epoch slot. In both
+// cases a thread probes linearly from there if its slot is taken.
+enum class SlotAssignment {
+  // Thread ordinal modulo the number of slots. Threads which come and go
+  // keep getting new ordinals and thus wander through the table.
+  Hashed,
+  // Dense thread index modulo the number of slots. Indices of exited threads
+  // are reused, so with at most `epoch_slots` live threads every thread has a
+  // slot of its own and uncontended reads succeed with the first CAS.
+  Registered,
+};
+
+// How readers announce their epoch. The store based protocols need a slot
+// which is exclusively owned by the reading thread, so they require
+// SlotAssignment::Registered: threads whose dense index is below
+// `epoch_slots` own that slot, all others share `overflow_slots` extra slots
+// with the compare-exchange protocol.
+enum class ReadProtocol {
+  // Claim a slot with a compare-exchange, probing if it is taken.
+  CompareExchange,
+  // Plain store to the owned slot followed by a full fence. The writer side
+  // issues a matching fence before scanning the slots.
+  StoreFence,
+  // Plain store to the owned slot and only a compiler barrier. Writers force
+  // the ordering with AsymmetricFence::heavy() before scanning the slots,
+  // which is a system call per scan but makes reads nearly free. Falls back
+  // to StoreFence if the platform does not support it.
+  Asymmetric,
+};
+
+// Diagnostics hook of a ResourceManager, called by a reader which found its
+// preferred slot busy and had to probe to `used_slot`. Must be thread-safe
+// and should be cheap, since it runs while the reader holds its slot.
+using SlotLogger = void (*)(size_t preferred_slot, size_t used_slot);
+
+// Coroutines which wait for a retire epoch of a domain to become
+// reclaimable, see `EpochDomain::reclaimed()`. They are resumed by whoever
+// calls `resume()`, which the domains do at the end of every `reclaim()`,
+// and by an optional background reclaimer thread, which parks until one of
+// the awaited epochs is reclaimable. Resumed coroutines continue on the
+// thread which resumed them.
+class ReclaimAwaiters {
+  struct Waiter {
+    uint64_t epoch;
+    std::coroutine_handle<> handle;
+  };
+  std::mutex mutex;
+  std::vector<Waiter> waiters;
+  std::condition_variable_any arrived;
+  std::jthread reclaimer;
+
+  static constexpr uint64_t NONE = UINT64_MAX;
+
+  // Oldest awaited epoch, NONE if there is no waiter. Needs `mutex`.
+  uint64_t oldest_locked() const {
+    uint64_t oldest = NONE;
+    for (Waiter const &w : waiters) {
+      oldest = std::min(oldest, w.epoch);
+    }
+    return oldest;
   }
 
 public:
-  // Check if all active readers are using newer epochs than the given one
-  void wait_reclaim(uint64_t epoch) {
-    for (const auto &slot : epoch_slots) {
-
-      // If slot is reading (non-zero) and using epoch <= target, we can't
-      // reclaim
-      while (true) {
-        uint64_t slot_epoch = slot.epoch.load(std::memory_order_acquire);
-        // This synchronizes with the memory_order_release in the `read()`
-        // method. We must be sure that no writes are reordered after
-        // the release or reads reordered before this acquire here to
-        // guarantee safe reclamation.
-        if (slot_epoch == 0 || slot_epoch > epoch) {
-          break;
+  // Awaiter of `co_await domain.reclaimed(epoch)`, which does not suspend
+  // at all if the epoch is reclaimable already.
+  template <typename Domain> class Awaitable {
+    Domain *domain;
+    ReclaimAwaiters *awaiters;
+    uint64_t epoch;
+
+  public:
+    Awaitable(Domain *domain, ReclaimAwaiters *awaiters, uint64_t epoch)
+        : domain(domain), awaiters(awaiters), epoch(epoch) {}
+
+    bool await_ready() { return domain->try_reclaim(epoch); }
+
+    // Once the coroutine is added, another thread may resume it and destroy
+    // this awaitable with the coroutine frame, so nothing here touches it
+    // afterwards. The epoch may have become reclaimable since
+    // `await_ready`, and nobody might look again, so it is checked again
+    // under the lock of the waiters, and we do not suspend then.
+    bool await_suspend(std::coroutine_handle<> handle) {
+      Domain *d = domain;
+      return awaiters->add_unless(
+          epoch, handle, [d](uint64_t e) { return d->try_reclaim(e); });
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  ~ReclaimAwaiters() { stop(); }
+
+  // Add a waiter for `epoch`, unless `reclaimable(epoch)` holds already.
+  // Both happen under the lock, so a concurrent `resume()` either sees the
+  // waiter or comes before the check. Returns true if the waiter was added.
+  template <typename Reclaimable>
+  bool add_unless(uint64_t epoch, std::coroutine_handle<> handle,
+                  Reclaimable &&reclaimable) {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      if (reclaimable(epoch)) {
+        return false;
+      }
+      waiters.push_back(Waiter{epoch, handle});
+    }
+    arrived.notify_one();
+    return true;
+  }
+
+  // Resume the coroutines whose epochs are reclaimable now, outside of the
+  // lock. Returns their number.
+  template <typename Reclaimable> size_t resume(Reclaimable &&reclaimable) {
+    std::vector<std::coroutine_handle<>> ready;
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      if (waiters.empty()) {
+        return 0;
+      }
+      auto it = std::partition(waiters.begin(), waiters.end(),
+                               [&reclaimable](Waiter const &w) {
+                                 return !reclaimable(w.epoch);
+                               });
+      for (auto r = it; r != waiters.end(); ++r) {
+        ready.push_back(r->handle);
+      }
+      waiters.erase(it, waiters.end());
+    }
+    for (std::coroutine_handle<> handle : ready) {
+      handle.resume();
+    }
+    return ready.size();
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return waiters.size();
+  }
+
+  // Start a background thread which calls `wait(epoch, timeout)` for the
+  // oldest awaited epoch, which should block for at most `timeout` until it
+  // is reclaimable, and then `reclaim()`, which resumes the waiters. Does
+  // nothing if it already runs. Must not race with `stop()`.
+  template <typename Wait, typename Reclaim>
+  void start(Wait wait, Reclaim reclaim, std::chrono::nanoseconds timeout) {
+    if (reclaimer.joinable()) {
+      return;
+    }
+    reclaimer = std::jthread([this, wait, reclaim,
+                              timeout](std::stop_token stop) {
+      while (!stop.stop_requested()) {
+        uint64_t oldest;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          arrived.wait_for(lock, stop, timeout,
+                           [this] { return !waiters.empty(); });
+          oldest = oldest_locked();
+        }
+        if (oldest != NONE) {
+          wait(oldest, timeout);
         }
-        cpu_relax();
+        reclaim();
       }
+    });
+  }
+
+  // Stop the background thread. Coroutines still waiting stay suspended
+  // until the next `resume()`.
+  void stop() {
+    if (reclaimer.joinable()) {
+      reclaimer.request_stop();
+      reclaimer.join();
     }
   }
+};
 
-  // Constructor with initial resource
-  explicit ResourceManager(std::unique_ptr<T> initial_resource)
-      : epoch_slots(EPOCH_SLOTS) {
-    current_resource.store(initial_resource.release(),
-                           std::memory_order_relaxed);
+template <typename Metrics = NoMetrics> class EpochDomain;
+template <typename T, typename Metrics = NoMetrics,
+          template <typename> class Reclamation = EpochDomain>
+class ResourceManager;
+
+// Pin several managers at once, e.g. for a request which reads a couple of
+// tables. Each manager is pinned with its own announcement; all of them are
+// released when the tuple is destroyed. Managers which share an EpochDomain
+// share a single announcement.
+template <typename... Ts, typename... Ms, template <typename> class... Rs>
+std::tuple<typename ResourceManager<Ts, Ms, Rs>::ReadGuard...>
+pin_all(ResourceManager<Ts, Ms, Rs> &...managers) {
+  return {managers.pin()...};
+}
+
+// Construction time configuration of a ResourceManager, or of an
+// EpochDomain shared by several managers.
+struct ResourceManagerOptions {
+  size_t epoch_slots = 128; // number of cache line sized reader slots
+  SlotAssignment slot_assignment = SlotAssignment::Hashed;
+  SlotLogger slot_logger = nullptr; // opt-in collision diagnostics
+  ReadProtocol read_protocol = ReadProtocol::CompareExchange;
+  size_t overflow_slots = 16; // shared slots for the store based protocols
+  // Give every NUMA node `epoch_slots` (and `overflow_slots`) slots of its
+  // own in node-local memory, threads announce in the slots of their node.
+  bool numa = false;
+  // With `numa`: number of nodes, 0 means all configured nodes.
+  size_t numa_nodes = 0;
+  // With `numa`: keep a replica of the current pointer and the epoch per
+  // node, which `update()` writes and readers read, so a read only touches
+  // memory of its own node.
+  bool numa_replicas = false;
+  // Number of older versions a manager keeps besides the current one, see
+  // `ResourceManager::read_at()`.
+  size_t retained_versions = 0;
+};
+
+// The class EpochDomain holds the epoch machinery of the ResourceManagers:
+// the global epoch, the reader slots, the watermark of the oldest active
+// reader and the limbo list of retired resources. Every manager creates a
+// private domain unless it is given a shared one. All managers of a shared
+// domain advance the same epoch, so
+//  - one announcement covers the reads of all of them: a thread which reads
+//    several managers of the domain, nested or under a domain `pin()`,
+//    claims a single slot,
+//  - there is one slot table for all of them instead of one per manager,
+//  - and a single scan of the slots in `reclaim()` or `wait_reclaim()`
+//    answers for the retirements of all of them.
+// The price is that a reader which holds one manager for a long time delays
+// the reclamation in all managers of the domain.
+// A domain must outlive the reads of its managers, which hold it with a
+// shared_ptr. With `Metrics = ThreadMetrics` it counts slot collisions,
+// probe lengths, slot scans and the time spent in wait_reclaim.
+template <typename Metrics> class EpochDomain {
+  template <typename, typename, template <typename> class>
+  friend class ResourceManager;
+
+  // Alignment for cache line to prevent false sharing
+  struct alignas(64) EpochSlot {
+    std::atomic<uint64_t> epoch{0};
+  };
+  using Slot = EpochSlot;
+
+  std::atomic<uint64_t> global_epoch{1}; // Start at 1, 0 means "not reading"
+  // Cached result of the last slot scan: every resource retired with an
+  // epoch below this watermark can be freed. Refreshed lazily.
+  std::atomic<uint64_t> min_active_epoch{1};
+
+  // Deferred reclamation: resources which have been retired but might still
+  // be in use by some reader. Each entry is tagged with its retire epoch,
+  // the resources of all managers of the domain share the list.
+  struct Retired {
+    uint64_t epoch;
+    std::unique_ptr<void, void (*)(void *)> resource;
+  };
+  std::mutex limbo_mutex;
+  std::vector<Retired> limbo;
+
+  // How threads are mapped onto the epoch slots of their node: with the
+  // compare-exchange protocol all `num_slots` slots are shared. With the
+  // store based protocols the first `num_slots` are owned by the thread
+  // with that dense index and the `overflow_slots` behind them are shared.
+  const size_t num_slots;
+  const size_t overflow_slots;
+  const SlotAssignment slot_assignment;
+  const SlotLogger slot_logger;
+  const ReadProtocol read_protocol;
+
+  // Copy of the epoch for the readers of one NUMA node, see
+  // ResourceManagerOptions::numa_replicas. The managers keep the copies of
+  // their pointers.
+  struct alignas(64) Replica {
+    std::atomic<uint64_t> epoch{1};
+  };
+
+  // Epoch slots for reader tracking, in one region per NUMA node (a single
+  // one without NUMA mode). A region holds the replica of its node followed
+  // by `slots_per_node` slots. In NUMA mode the regions are page aligned and
+  // bound to their nodes.
+  const size_t numa_nodes;
+  const bool replicate;
+  const size_t slots_per_node;
+  const size_t region_bytes;
+  NumaNode::Pages regions;
+
+  unsigned char *allocate_regions() const {
+    NumaNode::Pages memory = NumaNode::allocate(region_bytes, numa_nodes);
+    for (size_t node = 0; node < numa_nodes; ++node) {
+      unsigned char *region = memory.get() + node * region_bytes;
+      new (region) Replica();
+      std::uninitialized_default_construct_n(
+          reinterpret_cast<EpochSlot *>(region + sizeof(Replica)),
+          slots_per_node);
+    }
+    return memory.release();
   }
 
-  // Destructor
-  ~ResourceManager() {
-    auto [current, epoch] = update(nullptr);
-    wait_reclaim(epoch);
+  Replica &replica(size_t node) const {
+    return *std::launder(
+        reinterpret_cast<Replica *>(regions.get() + node * region_bytes));
   }
 
-  // Delete copy/move constructors and assignment operators
-  ResourceManager(const ResourceManager &) = delete;
-  ResourceManager &operator=(const ResourceManager &) = delete;
-  ResourceManager(ResourceManager &&) = delete;
-  ResourceManager &operator=(ResourceManager &&) = delete;
+  EpochSlot *node_slots(size_t node) const {
+    return std::launder(reinterpret_cast<EpochSlot *>(
+        regions.get() + node * region_bytes + sizeof(Replica)));
+  }
 
-  // Reader API: Get access to the resource
-  template <typename F>
-  auto read(F &&f) -> decltype(f(std::declval<const T &>())) {
-    // Get thread's slot
-    size_t slot = get_thread_slot();
+  // Global epoch covered by the last AsymmetricFence::heavy() of a scan.
+  std::atomic<uint64_t> fenced_epoch{0};
+
+  // Threads parked in `wait_reclaim()`: readers which see a non-zero count
+  // when they leave bump `release_seq` and wake them.
+  std::atomic<uint32_t> reclaim_waiters{0};
+  std::atomic<uint32_t> release_seq{0};
+
+  // Spin iterations before a waiter parks, and the longest a parked waiter
+  // sleeps before it rescans. The latter bounds the delay if a wake-up is
+  // missed because a reader's check of reclaim_waiters was reordered before
+  // its release of the slot.
+  static constexpr int RECLAIM_SPINS = 128;
+  static constexpr std::chrono::nanoseconds MAX_PARK =
+      std::chrono::milliseconds(1);
+
+  using Clock = std::chrono::steady_clock;
+
+  [[no_unique_address]] typename Metrics::template Counters<ManagerCounter>
+      metrics;
+
+  // Count a finished wait_reclaim which started at `start`.
+  void count_wait(Clock::time_point start) {
+    if constexpr (Metrics::template Counters<ManagerCounter>::enabled) {
+      metrics.add(ManagerCounter::ReclaimWaits);
+      metrics.add(ManagerCounter::ReclaimWaitNs,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count());
+    }
+  }
+
+  // Wait until `epoch` is reclaimable or the deadline has passed. Returns
+  // whether the epoch is reclaimable.
+  bool wait_reclaim_until(uint64_t epoch,
+                          std::optional<Clock::time_point> deadline) {
+    Clock::time_point start;
+    if constexpr (Metrics::template Counters<ManagerCounter>::enabled) {
+      start = Clock::now();
+    }
+    for (int i = 0; i < RECLAIM_SPINS; ++i) {
+      if (try_reclaim(epoch)) {
+        count_wait(start);
+        return true;
+      }
+      cpu_relax();
+    }
+    reclaim_waiters.fetch_add(1, std::memory_order_seq_cst);
+    bool reclaimable = false;
+    while (true) {
+      uint32_t seq = release_seq.load(std::memory_order_acquire);
+      if (try_reclaim(epoch)) {
+        reclaimable = true;
+        break;
+      }
+      auto park = MAX_PARK;
+      if (deadline) {
+        auto now = Clock::now();
+        if (now >= *deadline) {
+          break;
+        }
+        park = std::min<std::chrono::nanoseconds>(park, *deadline - now);
+      }
+      // Returns early if a reader has left in the meantime:
+      metrics.add(ManagerCounter::ReclaimParks);
+      Futex::wait(release_seq, seq, park);
+    }
+    reclaim_waiters.fetch_sub(1, std::memory_order_relaxed);
+    count_wait(start);
+    return reclaimable;
+  }
+
+  // Announce a read on a slot shared with other threads: probe the range
+  // [base, base + count) of `slots` starting at the thread's preferred slot
+  // until a compare-exchange from 0 succeeds, announcing the value of
+  // `epoch`.
+  EpochSlot *claim_shared_slot(EpochSlot *slots,
+                               std::atomic<uint64_t> const &epoch,
+                               size_t index, size_t base, size_t count) {
+    // Avoid the division if the index already fits, which is the normal
+    // case for dense indices:
+    size_t const preferred_slot =
+        base + (index < count ? index : index % count);
+    size_t slot = preferred_slot;
+    // Slots probed beyond the preferred one, only used for metrics
+    [[maybe_unused]] uint64_t probes = 0;
 
     // Get current global epoch
-    uint64_t current_epoch = global_epoch.load(std::memory_order_acquire);
+    uint64_t current_epoch = epoch.load(std::memory_order_acquire);
 
     // Try to find an available slot
     while (true) {
       // Try to announce reading at this epoch using compare_exchange
       uint64_t expected = 0; // expected: 0 (not in use)
-      if (epoch_slots[slot].epoch.compare_exchange_strong(
+      if (slots[slot].epoch.compare_exchange_strong(
               expected, current_epoch, std::memory_order_acquire,
               std::memory_order_relaxed)) {
         // We use acquire here, since we want to avoid that the subsequent
         // load of the resource pointer is not reordered before the store
         // to the epoch_slot!
         // Successfully claimed the slot
-        // Read resource pointer and execute reader function
-        T *resource_ptr = current_resource.load(std::memory_order_acquire);
-        // We use memory_order_acquire here to synchronize with the writer's
-        // store to be able to see stuff to which the pointer points.
-
-        using ReturnType = decltype(f(std::declval<const T &>()));
-
-        if constexpr (std::is_void_v<ReturnType>) {
-          // Handle void return type
-          if (resource_ptr != nullptr) {
-            f(*resource_ptr);
-          }
-
-          // Mark slot as "not reading" with a simple write
-          epoch_slots[slot].epoch.store(0, std::memory_order_release);
-          // This synchronizes with the `wait` or the `load` in the
-          // `wait_reclaim()` method.
-
-          return;
-        } else {
-          // Note that for the case of a nullptr, the result type should be
-          // default constructible!
-          ReturnType result{};
-
-          // Execute reader function
-          if (resource_ptr != nullptr) {
-            result = f(*resource_ptr);
-          }
-
-          // Mark slot as "not reading" with a simple write
-          epoch_slots[slot].epoch.store(0, std::memory_order_release);
-          // This synchronizes with the `wait` or the `load` in the
-          // `wait_reclaim()` method.
-
-          return result;
+        if (slot != preferred_slot && slot_logger != nullptr) [[unlikely]] {
+          slot_logger(preferred_slot, slot);
+        }
+        metrics.add(ManagerCounter::Reads);
+        if (probes > 0) {
+          metrics.add(ManagerCounter::SlotCollisions);
+          metrics.add(ManagerCounter::ProbeSteps, probes);
+          metrics.maximum(ManagerCounter::MaxProbe, probes);
         }
+        return &slots[slot];
       }
 
       // Slot is in use, try the next one:
+      ++probes;
       slot += 1;
-      slot = slot < EPOCH_SLOTS ? slot : slot - EPOCH_SLOTS;
+      slot = slot < base + count ? slot : slot - count;
       // Continue the loop with the new slot
     }
   }
 
-  // Writer API: Update the resource
-  std::pair<std::unique_ptr<T>, uint64_t>
-  update(std::unique_ptr<T> new_resource) {
-    std::lock_guard<std::mutex> lock(writer_mutex);
+  // Announce the epoch of the calling thread in a slot. Returns the slot
+  // which has to be cleared after the read. An `untracked` read is not
+  // recorded in the thread's pins, so a nested read of the same domain
+  // announces again. It must therefore not use the thread's owned slot and
+  // claims one of the shared slots instead.
+  EpochSlot *announce(bool untracked = false) {
+    size_t node = numa_nodes == 1 ? 0 : NumaNode::current() % numa_nodes;
+    EpochSlot *slots = node_slots(node);
+    std::atomic<uint64_t> const &epoch =
+        replicate ? replica(node).epoch : global_epoch;
 
+    if (read_protocol == ReadProtocol::CompareExchange) {
+      size_t index = slot_assignment == SlotAssignment::Registered
+                         ? ThreadIndex::dense()
+                         : ThreadIndex::ordinal();
+      return claim_shared_slot(slots, epoch, index, 0, num_slots);
+    }
+
+    size_t index = ThreadIndex::dense();
+    if (index >= num_slots || untracked) [[unlikely]] {
+      return claim_shared_slot(slots, epoch,
+                               index >= num_slots ? index - num_slots : index,
+                               num_slots, overflow_slots);
+    }
+
+    // Nobody else writes to an owned slot, and nested reads are tracked in
+    // the thread's pins and never get here, so the slot is free and a plain
+    // store suffices:
+    metrics.add(ManagerCounter::Reads);
+    EpochSlot &slot = slots[index];
+    slot.epoch.store(epoch.load(std::memory_order_acquire),
+                     std::memory_order_relaxed);
+    // The store to the slot must not be reordered with the subsequent load
+    // of the resource pointer. This pairs with the fence (or the heavy
+    // barrier) in `scan_min_active_epoch()`.
+    if (read_protocol == ReadProtocol::Asymmetric) {
+      AsymmetricFence::light();
+    } else {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    return &slot;
+  }
+
+  // Load the pointer to read from `source` after `enter_read()`.
+  template <typename P>
+  P *protect(EpochSlot *, std::atomic<P *> const &source) const {
+    // We use memory_order_acquire here to synchronize with the writer's
+    // store to be able to see stuff to which the pointer points.
+    return source.load(std::memory_order_acquire);
+  }
+
+  // Begin a read of the calling thread. If the thread is already reading
+  // from this domain, the outer announcement is reused and only a nesting
+  // counter is incremented. Returns the slot to pass to `leave_read()`.
+  EpochSlot *enter_read() {
+    ThreadPins &pins = thread_pins;
+    if (ThreadPins::Pin *pin = pins.find(this)) {
+      ++pin->depth;
+      return static_cast<EpochSlot *>(pin->slot);
+    }
+    // If the thread already pins too many domains, this read is not
+    // tracked, and nested reads announce again in a slot of their own.
+    if (pins.full()) [[unlikely]] {
+      return announce(true);
+    }
+    EpochSlot *slot = announce();
+    pins.add(this, slot);
+    return slot;
+  }
+
+  void leave_read(EpochSlot *slot) {
+    ThreadPins &pins = thread_pins;
+    ThreadPins::Pin *pin = pins.find(this);
+    if (pin != nullptr && pin->slot == slot) {
+      if (--pin->depth > 0) {
+        return; // still covered by an outer read
+      }
+      pins.remove(pin);
+    }
+    // Mark slot as "not reading" with a simple write
+    slot->epoch.store(0, std::memory_order_release);
+    // This synchronizes with the `load` in `scan_min_active_epoch()`.
+    if (reclaim_waiters.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+      release_seq.fetch_add(1, std::memory_order_release);
+      Futex::wake_all(release_seq);
+    }
+  }
+
+  // Scan all slots once and return the smallest epoch which some reader
+  // might still be using. Every resource retired with an epoch strictly
+  // below this value can safely be freed.
+  uint64_t scan_min_active_epoch() {
+    metrics.add(ManagerCounter::SlotScans);
+    // The global epoch has to be loaded before the slots are scanned. Any
+    // retirement with an epoch below this value has already swapped the
+    // resource pointer (acquire synchronizes with the release fetch_add in
+    // `advance()`), so readers announcing later will see the new pointer.
+    uint64_t min_epoch = global_epoch.load(std::memory_order_acquire);
+    // Readers with the store based protocols do not use a read-modify-write
+    // on their slot, so we need a fence between the pointer swap (which is
+    // covered by the load above) and the loads of the slots.
+    if (read_protocol == ReadProtocol::Asymmetric) {
+      // One heavy barrier covers all retirements up to `min_epoch`. The
+      // epoch is published only after the barrier has completed, so no scan
+      // can rely on a barrier which is still in progress.
+      if (fenced_epoch.load(std::memory_order_acquire) < min_epoch) {
+        AsymmetricFence::heavy();
+        uint64_t fenced = fenced_epoch.load(std::memory_order_relaxed);
+        while (fenced < min_epoch &&
+               !fenced_epoch.compare_exchange_weak(fenced, min_epoch,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+        }
+      }
+    } else if (read_protocol == ReadProtocol::StoreFence) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    for (size_t node = 0; node < numa_nodes; ++node) {
+      EpochSlot const *slots = node_slots(node);
+      for (size_t i = 0; i < slots_per_node; ++i) {
+        uint64_t slot_epoch = slots[i].epoch.load(std::memory_order_acquire);
+        // This synchronizes with the memory_order_release in the `read()`
+        // method, see `wait_reclaim()`.
+        if (slot_epoch != 0 && slot_epoch < min_epoch) {
+          min_epoch = slot_epoch;
+        }
+      }
+    }
+    return min_epoch;
+  }
+
+  // Rescan the slots and raise the cached watermark accordingly. Returns the
+  // new watermark.
+  uint64_t refresh_min_active_epoch() {
+    uint64_t scanned = scan_min_active_epoch();
+    uint64_t cached = min_active_epoch.load(std::memory_order_relaxed);
+    // The watermark only ever grows: once a retirement is safe to free, it
+    // stays safe, since readers announcing later see a newer pointer. The
+    // release here makes the scan's acquire loads visible to threads which
+    // only look at the cached value.
+    while (cached < scanned &&
+           !min_active_epoch.compare_exchange_weak(cached, scanned,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+    }
+    return std::max(cached, scanned);
+  }
+
+  // Advance the global epoch after a manager has swapped its pointer (and
+  // its replicas) away from `retired`. Returns the retire epoch of the old
+  // pointer. Writers of different managers advance concurrently, so the
+  // epoch is advanced with acquire too: the replicated epochs then also
+  // cover the pointer swaps of all writers which advanced before.
+  uint64_t advance(void const *) {
+    uint64_t retire_epoch =
+        global_epoch.fetch_add(1, std::memory_order_acq_rel);
+    // The replicated epochs follow only after all replicated pointers, so a
+    // reader which sees the new epoch on any node sees the new pointer on
+    // all nodes. They must not go backwards if writers overtake each other.
+    if (replicate) {
+      for (size_t node = 0; node < numa_nodes; ++node) {
+        std::atomic<uint64_t> &epoch = replica(node).epoch;
+        uint64_t seen = epoch.load(std::memory_order_relaxed);
+        while (seen < retire_epoch + 1 &&
+               !epoch.compare_exchange_weak(seen, retire_epoch + 1,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+      }
+    }
+    return retire_epoch;
+  }
+
+public:
+  explicit EpochDomain(ResourceManagerOptions options = {})
+      : num_slots(options.epoch_slots),
+        overflow_slots(options.read_protocol == ReadProtocol::CompareExchange
+                           ? 0
+                           : options.overflow_slots),
+        slot_assignment(options.slot_assignment),
+        slot_logger(options.slot_logger),
+        read_protocol(options.read_protocol == ReadProtocol::Asymmetric &&
+                              !AsymmetricFence::available()
+                          ? ReadProtocol::StoreFence
+                          : options.read_protocol),
+        numa_nodes(!options.numa            ? 1
+                   : options.numa_nodes > 0 ? options.numa_nodes
+                                            : NumaNode::count()),
+        replicate(options.numa && options.numa_replicas),
+        slots_per_node(num_slots + overflow_slots),
+        region_bytes(NumaNode::stride(
+            sizeof(Replica) + slots_per_node * sizeof(EpochSlot), numa_nodes)),
+        regions(allocate_regions()) {
+    if (num_slots == 0) {
+      throw std::invalid_argument(
+          "ResourceManager: epoch_slots must be > 0");
+    }
+    if (read_protocol != ReadProtocol::CompareExchange &&
+        (slot_assignment != SlotAssignment::Registered ||
+         overflow_slots == 0)) {
+      throw std::invalid_argument(
+          "ResourceManager: store based read protocols need registered slot "
+          "assignment and overflow_slots > 0");
+    }
+  }
+
+  // No reader may be left, the remaining retired resources are freed.
+  ~EpochDomain() = default;
+
+  EpochDomain(const EpochDomain &) = delete;
+  EpochDomain &operator=(const EpochDomain &) = delete;
+
+  // Move-only handle which keeps the calling thread's epoch announced, so
+  // the resources which all managers of the domain publish at this time are
+  // not reclaimed while it is alive. Reads of these managers under the
+  // guard only bump the nesting counter. Must be released on the thread
+  // which created it.
+  class Guard {
+    friend class EpochDomain;
+
+    EpochDomain *domain = nullptr;
+    EpochSlot *slot = nullptr;
+
+    Guard(EpochDomain *domain, EpochSlot *slot) : domain(domain), slot(slot) {}
+
+  public:
+    Guard() = default;
+
+    Guard(Guard &&other) noexcept
+        : domain(std::exchange(other.domain, nullptr)),
+          slot(std::exchange(other.slot, nullptr)) {}
+
+    Guard &operator=(Guard &&other) noexcept {
+      if (this != &other) {
+        reset();
+        domain = std::exchange(other.domain, nullptr);
+        slot = std::exchange(other.slot, nullptr);
+      }
+      return *this;
+    }
+
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+
+    ~Guard() { reset(); }
+
+    void reset() noexcept {
+      if (domain != nullptr) {
+        domain->leave_read(slot);
+        domain = nullptr;
+        slot = nullptr;
+      }
+    }
+  };
+
+  // Announce the calling thread once for the reads of all managers of the
+  // domain which follow while the guard is alive.
+  Guard pin() { return Guard(this, enter_read()); }
+
+  // Advance the global epoch after swapping a pointer which readers load
+  // under `pin()` by themselves, outside of any manager of the domain.
+  // Returns the retire epoch of the old pointer, see `try_reclaim()`.
+  uint64_t advance() { return advance(nullptr); }
+
+  // Wait until all active readers are using newer epochs than the given
+  // one. Usually this is answered by the cached watermark with a single
+  // load, only if this is not sufficient the slots are scanned again. After
+  // a short spin the thread parks and is woken by the leaving readers.
+  void wait_reclaim(uint64_t epoch) { wait_reclaim_until(epoch, std::nullopt); }
+
+  // Like `wait_reclaim()`, but gives up after `timeout`. Returns true if
+  // the epoch is reclaimable.
+  template <typename Rep, typename Period>
+  bool wait_reclaim_for(uint64_t epoch,
+                        std::chrono::duration<Rep, Period> timeout) {
+    return wait_reclaim_until(epoch, Clock::now() + timeout);
+  }
+
+  // Returns true if a resource retired with `epoch` can no longer be seen by
+  // any reader. Does not block.
+  bool try_reclaim(uint64_t epoch) {
+    if (min_active_epoch.load(std::memory_order_acquire) > epoch) {
+      return true;
+    }
+    return refresh_min_active_epoch() > epoch;
+  }
+
+  // Hand a resource which was returned by `update()` of any manager of the
+  // domain over to deferred reclamation. It is freed by a later call to
+  // `reclaim()` once no reader can still be using it.
+  template <typename T>
+  void retire(std::unique_ptr<T> resource, uint64_t epoch) {
+    if (resource == nullptr) {
+      return;
+    }
+    std::unique_ptr<void, void (*)(void *)> erased(
+        resource.release(),
+        [](void *resource) { delete static_cast<T *>(resource); });
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    limbo.push_back(Retired{epoch, std::move(erased)});
+  }
+
+  // Free all retired resources of all managers of the domain which are no
+  // longer visible to any reader. This never blocks on readers, it does a
+  // single scan of the epoch slots for the whole batch. Returns the number
+  // of resources which were freed.
+  size_t reclaim() {
+    size_t freed = reclaim_limbo();
+    awaiters.resume([this](uint64_t epoch) { return try_reclaim(epoch); });
+    return freed;
+  }
+
+  // Coroutine variant of `wait_reclaim()`: `co_await domain.reclaimed(epoch)`
+  // suspends the coroutine until all readers have left `epoch`, see
+  // `wait_reclaim()`. It is resumed by the next `reclaim()` which finds the
+  // epoch reclaimable, or by the background reclaimer, and continues on
+  // that thread.
+  ReclaimAwaiters::Awaitable<EpochDomain> reclaimed(uint64_t epoch) {
+    return {this, &awaiters, epoch};
+  }
+
+  // Start a background thread which waits for the epochs of suspended
+  // coroutines and resumes them (and frees retired resources meanwhile).
+  // Without coroutines waiting it looks every `poll` for retired resources.
+  void start_reclaimer(std::chrono::nanoseconds poll = MAX_PARK) {
+    awaiters.start(
+        [this](uint64_t epoch, std::chrono::nanoseconds timeout) {
+          wait_reclaim_for(epoch, timeout);
+        },
+        [this]() { reclaim(); }, poll);
+  }
+
+  void stop_reclaimer() { awaiters.stop(); }
+
+private:
+  // The freeing part of `reclaim()`.
+  size_t reclaim_limbo() {
+    std::vector<Retired> ready;
+    {
+      std::lock_guard<std::mutex> guard(limbo_mutex);
+      if (limbo.empty()) {
+        return 0;
+      }
+      // One comparison per entry against the cached watermark, the slots
+      // are only rescanned if the watermark does not cover the whole batch.
+      uint64_t min_epoch = min_active_epoch.load(std::memory_order_acquire);
+      uint64_t max_retired = 0;
+      for (auto const &r : limbo) {
+        max_retired = std::max(max_retired, r.epoch);
+      }
+      if (max_retired >= min_epoch) {
+        min_epoch = refresh_min_active_epoch();
+      }
+      auto it = std::partition(
+          limbo.begin(), limbo.end(),
+          [min_epoch](Retired const &r) { return r.epoch >= min_epoch; });
+      ready.assign(std::make_move_iterator(it),
+                   std::make_move_iterator(limbo.end()));
+      limbo.erase(it, limbo.end());
+    }
+    // The actual deallocation happens outside of the lock.
+    return ready.size();
+  }
+
+public:
+  // Number of retired resources which are still waiting to be freed.
+  size_t pending_retirements() {
+    std::lock_guard<std::mutex> guard(limbo_mutex);
+    return limbo.size();
+  }
+
+  // Counters (if metrics are enabled) and the current epochs and backlog.
+  // The counters are summed up over all threads without stopping them, so
+  // they are only approximately consistent with each other.
+  ResourceManagerStats stats() {
+    ResourceManagerStats result;
+    result.reads = metrics.total(ManagerCounter::Reads);
+    result.slot_collisions = metrics.total(ManagerCounter::SlotCollisions);
+    result.probe_steps = metrics.total(ManagerCounter::ProbeSteps);
+    result.max_probe = metrics.max(ManagerCounter::MaxProbe);
+    result.slot_scans = metrics.total(ManagerCounter::SlotScans);
+    result.reclaim_waits = metrics.total(ManagerCounter::ReclaimWaits);
+    result.reclaim_wait_ns = metrics.total(ManagerCounter::ReclaimWaitNs);
+    result.reclaim_parks = metrics.total(ManagerCounter::ReclaimParks);
+    result.global_epoch = global_epoch.load(std::memory_order_relaxed);
+    result.min_active_epoch = min_active_epoch.load(std::memory_order_relaxed);
+    result.pending_retirements = pending_retirements();
+    result.epoch_slots = num_slots;
+    result.numa_nodes = numa_nodes;
+    return result;
+  }
+
+  // The read protocol in effect (Asymmetric may have fallen back).
+  ReadProtocol protocol() const { return read_protocol; }
+
+private:
+  // Coroutines suspended in `reclaimed()`, and the background reclaimer.
+  // Declared last, so the reclaimer is stopped before anything else goes.
+  ReclaimAwaiters awaiters;
+};
+
+// With `Metrics = ThreadMetrics` the manager counts slot collisions, probe
+// lengths, slot scans and the time spent in wait_reclaim, see `stats()`.
+// Managers which are constructed with the same domain share one
+// announcement, slot table and reclamation, see EpochDomain.
+// The reclamation scheme is a policy: the domain template `Reclamation`,
+// which is EpochDomain (epoch based reclamation) by default. The
+// alternatives are HazardDomain (hazard pointers, HazardDomain.h), which
+// bounds the garbage behind a slow reader to what it holds, and
+// QuiescentDomain (quiescent state based reclamation, QuiescentDomain.h),
+// which makes reads free for threads with natural quiescent points. All of
+// them hand out a retire epoch from `update()` which `wait_reclaim()`,
+// `try_reclaim()` and `retire()` take.
+template <typename T, typename Metrics, template <typename> class Reclamation>
+class ResourceManager {
+public:
+  using Domain = Reclamation<Metrics>;
+
+private:
+  using EpochSlot = typename Domain::Slot;
+
+  // The domain is only referenced through the raw pointer on the hot paths.
+  std::shared_ptr<Domain> domain_owner;
+  Domain *const domain;
+
+  // Resource management
+  std::atomic<T *> current_resource;
+  std::mutex writer_mutex;
+  // Latest resource handed to `update_coalesced()` which is not yet published
+  std::atomic<T *> pending_resource{nullptr};
+
+  // Copy of the published pointer for the readers of one NUMA node, see
+  // ResourceManagerOptions::numa_replicas.
+  struct alignas(64) Replica {
+    std::atomic<T *> resource{nullptr};
+  };
+
+  // The last `retained_versions + 1` published versions, version v in slot
+  // v % size. The ring owns them, so `update()` hands out the version which
+  // falls out of it. A slot's version number is 0 while the writer replaces
+  // its resource, so readers can check that they got the version they asked
+  // for like with a seqlock. Versions are counted per manager from 1 on,
+  // since the epochs of a shared domain also advance for other managers.
+  struct VersionSlot {
+    std::atomic<uint64_t> version{0};
+    std::atomic<T *> resource{nullptr};
+  };
+  const size_t ring_size;
+  std::unique_ptr<VersionSlot[]> versions;
+  std::atomic<uint64_t> latest_version{1};
+
+  // Load the resource of `version` under the announcement in `slot`, or
+  // return false if the ring does not hold that version (any more).
+  bool load_version(EpochSlot *slot, uint64_t version, T *&resource) const {
+    if (version == 0) {
+      return false;
+    }
+    VersionSlot const &entry = versions[version % ring_size];
+    if (entry.version.load(std::memory_order_acquire) != version) {
+      return false;
+    }
+    resource = domain->protect(slot, entry.resource);
+    // Pairs with the release fence in `publish_locked()`: if the slot was
+    // overwritten while we loaded it, we see its new version number.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return entry.version.load(std::memory_order_relaxed) == version;
+  }
+
+  // One replica per node, on a page of that node, if the domain replicates.
+  const size_t replica_bytes = NumaNode::stride(sizeof(Replica),
+                                                domain->numa_nodes);
+  NumaNode::Pages replicas;
+
+  Replica &replica(size_t node) const {
+    return *std::launder(
+        reinterpret_cast<Replica *>(replicas.get() + node * replica_bytes));
+  }
+
+  // Swap in a new resource and advance the epoch. The caller must hold
+  // writer_mutex.
+  std::pair<std::unique_ptr<T>, uint64_t>
+  publish_locked(std::unique_ptr<T> new_resource) {
     // Extract raw pointer from unique_ptr
     T *new_ptr = new_resource.release();
 
     // Swap pointers:
-    T *old_ptr = current_resource.exchange(new_ptr, std::memory_order_release);
+    current_resource.store(new_ptr, std::memory_order_release);
     // This release synchronizes with the acquire in the read method.
+    if (domain->replicate) {
+      for (size_t node = 0; node < domain->numa_nodes; ++node) {
+        replica(node).resource.store(new_ptr, std::memory_order_release);
+      }
+    }
+
+    // The new version takes the ring slot of the oldest one, which is the
+    // resource to retire. Without retained versions this is the previous
+    // current resource.
+    uint64_t version = latest_version.load(std::memory_order_relaxed) + 1;
+    VersionSlot &entry = versions[version % ring_size];
+    T *retired = entry.resource.load(std::memory_order_relaxed);
+    entry.version.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.resource.store(new_ptr, std::memory_order_relaxed);
+    entry.version.store(version, std::memory_order_release);
+    latest_version.store(version, std::memory_order_release);
 
     // Advance global epoch with release to ensure all threads see the new epoch
     // and new current_resource:
-    uint64_t retire_epoch =
-        global_epoch.fetch_add(1, std::memory_order_release);
+    uint64_t retire_epoch = domain->advance(retired);
 
     // We need that everybody who still sees the old value also uses the old
     // epoch! Therefore it is crucial that we first write the new pointer here
@@ -186,10 +1390,424 @@ public:
     // and then load the pointer. Therefore, it is possible (and tolerable)
     // that a reader uses the new pointer value together with the old epoch,
     // but no harm results from this!
-    return std::pair(std::unique_ptr<T>(old_ptr), retire_epoch);
+    return std::pair(std::unique_ptr<T>(retired), retire_epoch);
   }
-};
 
-// Initialize the thread_local storage
-template <typename T>
-thread_local std::optional<size_t> ResourceManager<T>::thread_slot_index;
+public:
+  // Wait until all active readers of the domain are using newer epochs
+  // than the given one, see EpochDomain.
+  void wait_reclaim(uint64_t epoch) { domain->wait_reclaim(epoch); }
+
+  // Like `wait_reclaim()`, but gives up after `timeout`. Returns true if
+  // the epoch is reclaimable.
+  template <typename Rep, typename Period>
+  bool wait_reclaim_for(uint64_t epoch,
+                        std::chrono::duration<Rep, Period> timeout) {
+    return domain->wait_reclaim_for(epoch, timeout);
+  }
+
+  // Returns true if a resource retired with `epoch` can no longer be seen by
+  // any reader. Does not block.
+  bool try_reclaim(uint64_t epoch) { return domain->try_reclaim(epoch); }
+
+  // Hand a resource which was returned by `update()` over to deferred
+  // reclamation. It is freed by a later call to `reclaim()` once no reader
+  // can still be using it.
+  void retire(std::unique_ptr<T> resource, uint64_t epoch) {
+    domain->retire(std::move(resource), epoch);
+  }
+
+  // Free all retired resources which are no longer visible to any reader,
+  // in a shared domain those of all its managers. This never blocks on
+  // readers, it does a single scan of the epoch slots for the whole batch.
+  // It can be called by a cleanup thread, but it is also called from
+  // `update_deferred()`. Returns the number of resources which were freed.
+  size_t reclaim() { return domain->reclaim(); }
+
+  // Coroutine variant of `wait_reclaim()`, see EpochDomain::reclaimed():
+  //   auto [old, epoch] = manager.update(std::move(next));
+  //   co_await manager.reclaimed(epoch);
+  // suspends the coroutine instead of blocking its thread. It is resumed by
+  // the next `reclaim()` which finds the epoch reclaimable, or by the
+  // background reclaimer of the domain (`start_reclaimer()`).
+  auto reclaimed(uint64_t epoch) { return domain->reclaimed(epoch); }
+
+  // Start (or stop) the background reclaimer of the domain, which resumes
+  // coroutines waiting in `reclaimed()` and frees retired resources.
+  void start_reclaimer(
+      std::chrono::nanoseconds poll = std::chrono::milliseconds(1)) {
+    domain->start_reclaimer(poll);
+  }
+  void stop_reclaimer() { domain->stop_reclaimer(); }
+
+  // Number of retired resources which are still waiting to be freed, in a
+  // shared domain those of all its managers.
+  size_t pending_retirements() { return domain->pending_retirements(); }
+
+  // Counters (if metrics are enabled) and the current epochs and backlog of
+  // the domain.
+  ResourceManagerStats stats() { return domain->stats(); }
+
+  // Constructor with initial resource. The number of epoch slots bounds the
+  // number of concurrent readers which do not have to probe for a slot.
+  explicit ResourceManager(std::unique_ptr<T> initial_resource,
+                           ResourceManagerOptions options = {})
+      : ResourceManager(std::move(initial_resource),
+                        std::make_shared<Domain>(options),
+                        options.retained_versions) {}
+
+  // Constructor for a manager in a shared domain, which determines all
+  // options but the number of retained versions.
+  ResourceManager(std::unique_ptr<T> initial_resource,
+                  std::shared_ptr<Domain> shared_domain,
+                  size_t retained_versions = 0)
+      : domain_owner(std::move(shared_domain)), domain(domain_owner.get()),
+        ring_size(retained_versions + 1),
+        versions(new VersionSlot[ring_size]),
+        replicas(domain->replicate
+                     ? NumaNode::allocate(replica_bytes, domain->numa_nodes)
+                     : nullptr) {
+    if (domain->replicate) {
+      for (size_t node = 0; node < domain->numa_nodes; ++node) {
+        new (replicas.get() + node * replica_bytes) Replica();
+        replica(node).resource.store(initial_resource.get(),
+                                     std::memory_order_relaxed);
+      }
+    }
+    versions[1 % ring_size].version.store(1, std::memory_order_relaxed);
+    versions[1 % ring_size].resource.store(initial_resource.get(),
+                                           std::memory_order_relaxed);
+    current_resource.store(initial_resource.release(),
+                           std::memory_order_relaxed);
+  }
+
+  // The read protocol in effect (Asymmetric may have fallen back).
+  ReadProtocol protocol() const { return domain->protocol(); }
+
+  // The domain of the manager, e.g. to join a QuiescentDomain.
+  Domain &epoch_domain() const { return *domain; }
+
+  // Destructor
+  ~ResourceManager() {
+    auto [current, epoch] = update(nullptr);
+    // All retired resources carry an epoch <= `epoch`, so once this returns
+    // they can all be freed together with the last one. In a shared domain
+    // they have to be freed now, before the domain forgets about them.
+    wait_reclaim(epoch);
+    reclaim();
+    // No reader is left, so the versions still retained can go as well.
+    for (size_t i = 0; i < ring_size; ++i) {
+      delete versions[i].resource.load(std::memory_order_relaxed);
+    }
+    // Nothing can be pending once all update_coalesced() calls have
+    // returned, but do not leak if it is:
+    delete pending_resource.exchange(nullptr, std::memory_order_acquire);
+  }
+
+  // Delete copy/move constructors and assignment operators
+  ResourceManager(const ResourceManager &) = delete;
+  ResourceManager &operator=(const ResourceManager &) = delete;
+  ResourceManager(ResourceManager &&) = delete;
+  ResourceManager &operator=(ResourceManager &&) = delete;
+
+  // Move-only handle which keeps the calling thread's epoch announced. As
+  // long as it is alive, the resource it points to is not reclaimed, so a
+  // reader can do many lookups under a single announcement. The guard must
+  // be released on the thread which created it. Further guards (or reads)
+  // of the same domain on the same thread only bump a nesting counter, so
+  // they are nearly free, but they have to be released in reverse order of
+  // creation.
+  class ReadGuard {
+    friend class ResourceManager;
+
+    Domain *domain = nullptr;
+    EpochSlot *slot = nullptr;
+    T const *resource = nullptr;
+
+    ReadGuard(Domain *domain, EpochSlot *slot, T const *resource)
+        : domain(domain), slot(slot), resource(resource) {}
+
+  public:
+    ReadGuard() = default;
+
+    ReadGuard(ReadGuard &&other) noexcept
+        : domain(std::exchange(other.domain, nullptr)),
+          slot(std::exchange(other.slot, nullptr)),
+          resource(std::exchange(other.resource, nullptr)) {}
+
+    ReadGuard &operator=(ReadGuard &&other) noexcept {
+      if (this != &other) {
+        reset();
+        domain = std::exchange(other.domain, nullptr);
+        slot = std::exchange(other.slot, nullptr);
+        resource = std::exchange(other.resource, nullptr);
+      }
+      return *this;
+    }
+
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+
+    ~ReadGuard() { reset(); }
+
+    // Give up the announcement early. The pointer must not be used after
+    // this.
+    void reset() noexcept {
+      if (domain != nullptr) {
+        domain->leave_read(slot);
+        domain = nullptr;
+        slot = nullptr;
+        resource = nullptr;
+      }
+    }
+
+    // The pinned resource, nullptr if there is none.
+    T const *get() const noexcept { return resource; }
+    T const &operator*() const noexcept { return *resource; }
+    T const *operator->() const noexcept { return resource; }
+    explicit operator bool() const noexcept { return resource != nullptr; }
+  };
+
+  // Reader API: Pin the current resource
+  ReadGuard pin() {
+    EpochSlot *slot = domain->enter_read();
+
+    // Read resource pointer
+    // Readers of any node may use any replica, since all of them are at
+    // least as new as the epoch announced.
+    T *resource_ptr = domain->protect(
+        slot, domain->replicate
+                  ? replica(NumaNode::cached() % domain->numa_nodes).resource
+                  : current_resource);
+
+    return ReadGuard(domain, slot, resource_ptr);
+  }
+
+  // Reader API: Get access to the resource. The result of `f` is returned
+  // by value, since the resource may be reclaimed as soon as the read is
+  // over. If there is no resource (the manager holds a nullptr), `f` is not
+  // called and a default constructed result is returned, so results must be
+  // default constructible. Use `try_read()` for other results, or to tell
+  // the missing resource apart.
+  template <typename F>
+  auto read(F &&f) -> decltype(f(std::declval<const T &>())) {
+    using ReturnType = decltype(f(std::declval<const T &>()));
+    static_assert(!std::is_reference_v<ReturnType>,
+                  "ResourceManager::read: the reader function must not "
+                  "return a reference, it would dangle after the read");
+    static_assert(std::is_void_v<ReturnType> ||
+                      std::is_default_constructible_v<ReturnType>,
+                  "ResourceManager::read: the result must be default "
+                  "constructible, use try_read otherwise");
+
+    ReadGuard guard = pin();
+
+    if constexpr (std::is_void_v<ReturnType>) {
+      // Handle void return type
+      if (guard) {
+        f(*guard);
+      }
+    } else {
+      // The result is constructed directly from the reader function, the
+      // guard is only released afterwards.
+      if (guard) {
+        return f(*guard);
+      }
+      return ReturnType{};
+    }
+  }
+
+  // Reader API: Like `read()`, but returns std::nullopt if there is no
+  // resource, so the result need not be default constructible.
+  template <typename F>
+  auto try_read(F &&f)
+      -> std::optional<decltype(f(std::declval<const T &>()))> {
+    using ReturnType = decltype(f(std::declval<const T &>()));
+    static_assert(!std::is_reference_v<ReturnType> &&
+                      !std::is_void_v<ReturnType>,
+                  "ResourceManager::try_read: the reader function must "
+                  "return a value");
+
+    ReadGuard guard = pin();
+    if (!guard) {
+      return std::nullopt;
+    }
+    return f(*guard);
+  }
+
+  // Reader API: Like `read()`, but `f` gets a mutable reference. This is
+  // meant for resources which synchronize their own mutations (e.g. a
+  // lock-free container), where the manager only governs the lifetime of
+  // the object and readers modify its contents concurrently. The manager
+  // itself never assumes a published resource is unchanged.
+  template <typename F>
+  auto read_mut(F &&f) -> decltype(f(std::declval<T &>())) {
+    using ReturnType = decltype(f(std::declval<T &>()));
+    static_assert(!std::is_reference_v<ReturnType>,
+                  "ResourceManager::read_mut: the reader function must not "
+                  "return a reference, it would dangle after the read");
+    static_assert(std::is_void_v<ReturnType> ||
+                      std::is_default_constructible_v<ReturnType>,
+                  "ResourceManager::read_mut: the result must be default "
+                  "constructible");
+
+    EpochSlot *slot = domain->enter_read();
+    T *resource_ptr = domain->protect(
+        slot, domain->replicate
+                  ? replica(NumaNode::cached() % domain->numa_nodes).resource
+                  : current_resource);
+    ReadGuard guard(domain, slot, resource_ptr);
+
+    if constexpr (std::is_void_v<ReturnType>) {
+      if (resource_ptr != nullptr) {
+        f(*resource_ptr);
+      }
+    } else {
+      if (resource_ptr != nullptr) {
+        return f(*resource_ptr);
+      }
+      return ReturnType{};
+    }
+  }
+
+  // Number of the current version. Versions are numbered from 1 on, every
+  // publication of a resource makes a new one.
+  uint64_t current_version() const {
+    return latest_version.load(std::memory_order_acquire);
+  }
+
+  // Reader API: Pin the current resource together with its version number,
+  // e.g. to run a computation over several reads against the same version
+  // with `read_at()`.
+  std::pair<ReadGuard, uint64_t> pin_version() {
+    EpochSlot *slot = domain->enter_read();
+    T *resource_ptr = nullptr;
+    uint64_t version;
+    do {
+      version = latest_version.load(std::memory_order_acquire);
+    } while (!load_version(slot, version, resource_ptr));
+    return {ReadGuard(domain, slot, resource_ptr), version};
+  }
+
+  // Reader API: Pin the given version, if it is still retained. Otherwise
+  // the guard is empty.
+  ReadGuard pin_at(uint64_t version) {
+    EpochSlot *slot = domain->enter_read();
+    T *resource_ptr = nullptr;
+    if (!load_version(slot, version, resource_ptr)) {
+      domain->leave_read(slot);
+      return ReadGuard();
+    }
+    return ReadGuard(domain, slot, resource_ptr);
+  }
+
+  // Reader API: Get access to the given version. With
+  // `retained_versions = K` the current and the K previous versions can be
+  // read, so a long computation can do many short reads of a stable version
+  // without holding back the reclamation of the versions after it. Throws
+  // std::out_of_range if the version is no longer (or not yet) retained, or
+  // if it has no resource. Like with `read()`, the result must not be a
+  // reference into the version.
+  template <typename F>
+  auto read_at(uint64_t version, F &&f)
+      -> decltype(f(std::declval<const T &>())) {
+    static_assert(!std::is_reference_v<decltype(f(std::declval<const T &>()))>,
+                  "ResourceManager::read_at: the reader function must not "
+                  "return a reference, it would dangle after the read");
+    ReadGuard guard = pin_at(version);
+    if (!guard) {
+      throw std::out_of_range("ResourceManager: version not retained");
+    }
+    return f(*guard);
+  }
+
+  // Writer API: Update the resource
+  std::pair<std::unique_ptr<T>, uint64_t>
+  update(std::unique_ptr<T> new_resource) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    return publish_locked(std::move(new_resource));
+  }
+
+  // Writer API: Update the resource without waiting for readers. The old
+  // resource is put into the limbo list and freed by a later `reclaim()`.
+  // Reclamation of earlier retirements is piggy-backed onto this call, so a
+  // steady stream of updates keeps the limbo list short. Returns the retire
+  // epoch of the old resource.
+  uint64_t update_deferred(std::unique_ptr<T> new_resource) {
+    auto [old_resource, epoch] = update(std::move(new_resource));
+    retire(std::move(old_resource), epoch);
+    reclaim();
+    return epoch;
+  }
+
+  // Writer API: Read-copy-update. Under the writer mutex the callback sees
+  // the current resource and produces the next version, which is published
+  // and the old one handed to deferred reclamation. Since concurrent writers
+  // are serialized, no update is lost. The callback either takes a
+  // `T const &` and returns a `std::unique_ptr<T>` (which allows structural
+  // sharing, e.g. of `shared_ptr<const ...>` members), or it takes a `T &`
+  // and modifies a copy of the current resource in place. Returns the
+  // retire epoch of the old resource. If there is no resource, `f` is not
+  // called, nothing is published and 0 is returned.
+  template <typename F>
+    requires std::is_invocable_r_v<std::unique_ptr<T>, F, T const &> ||
+             (std::is_invocable_v<F, T &> && std::is_copy_constructible_v<T>)
+  uint64_t modify(F &&f) {
+    uint64_t epoch;
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      // Only writers change the pointer, so no announcement is needed:
+      T const *current = current_resource.load(std::memory_order_acquire);
+      if (current == nullptr) {
+        return 0;
+      }
+      std::unique_ptr<T> next;
+      if constexpr (std::is_invocable_r_v<std::unique_ptr<T>, F,
+                                          T const &>) {
+        next = std::forward<F>(f)(*current);
+      } else {
+        next = std::make_unique<T>(*current);
+        std::forward<F>(f)(*next);
+      }
+      auto [old_resource, retire_epoch] = publish_locked(std::move(next));
+      retire(std::move(old_resource), retire_epoch);
+      epoch = retire_epoch;
+    }
+    reclaim();
+    return epoch;
+  }
+
+  // Writer API: Update the resource, coalescing with concurrent writers.
+  // Only the latest of several concurrent updates matters, so writers drop
+  // their resource into a single pending slot and whoever gets the writer
+  // mutex next publishes whatever is pending then, with a single pointer
+  // swap and epoch increment for the whole batch. Resources which were
+  // superseded while pending were never visible to readers and are freed
+  // immediately, the published old resource goes to deferred reclamation.
+  // Returns the retire epoch if this call published, and 0 if its resource
+  // was superseded or published by another writer.
+  uint64_t update_coalesced(std::unique_ptr<T> new_resource) {
+    std::unique_ptr<T> superseded(
+        pending_resource.exchange(new_resource.release(),
+                                  std::memory_order_acq_rel));
+    superseded.reset();
+
+    uint64_t epoch = 0;
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      // Our resource (or a newer one) is either still pending, or some
+      // writer which got the mutex after we made it pending has published
+      // it already.
+      std::unique_ptr<T> next(
+          pending_resource.exchange(nullptr, std::memory_order_acq_rel));
+      if (next == nullptr) {
+        return 0;
+      }
+      auto [old_resource, retire_epoch] = publish_locked(std::move(next));
+      retire(std::move(old_resource), retire_epoch);
+      epoch = retire_epoch;
+    }
+    reclaim();
+    return epoch;
+  }
+};
@@ -1,6 +1,15 @@
+#include "HazardDomain.h"
+#include "QuiescentDomain.h"
 #include "ResourceManager.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <coroutine>
+#include <ctime>
+#include <exception>
 #include <iostream>
+#include <latch>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
@@ -56,6 +65,1007 @@ void writer_thread(std::shared_ptr<ResourceManager<std::string>> manager,
   std::cout << "Writer finished" << std::endl;
 }
 
+// Deferred reclamation: update without waiting and free retired resources
+// in batches. Returns false if something went wrong.
+bool test_deferred_reclamation() {
+  std::cout << "Testing deferred reclamation" << std::endl;
+
+  ResourceManager<std::string> manager(
+      std::make_unique<std::string>("Deferred 0"));
+
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; ++i) {
+    readers.emplace_back([&manager, &stop]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        manager.read([](const std::string &resource) {
+          volatile size_t len = resource.length();
+          return len;
+        });
+      }
+    });
+  }
+
+  const int num_updates = 1000;
+  uint64_t last_epoch = 0;
+  for (int i = 1; i <= num_updates; ++i) {
+    last_epoch = manager.update_deferred(
+        std::make_unique<std::string>("Deferred " + std::to_string(i)));
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &thread : readers) {
+    thread.join();
+  }
+
+  // Without any reader around, the watermark passes every retirement and a
+  // single reclaim frees the whole backlog:
+  if (!manager.try_reclaim(last_epoch)) {
+    std::cout << "Epoch " << last_epoch << " not reclaimable without readers"
+              << std::endl;
+    return false;
+  }
+  manager.reclaim();
+  if (manager.pending_retirements() != 0) {
+    std::cout << "Deferred reclamation left " << manager.pending_retirements()
+              << " retired resources behind" << std::endl;
+    return false;
+  }
+
+  auto value =
+      manager.read([](const std::string &resource) { return resource; });
+  if (value != "Deferred " + std::to_string(num_updates)) {
+    std::cout << "Unexpected value after deferred updates: " << value
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Deferred reclamation test passed" << std::endl;
+  return true;
+}
+
+// A small slot table with registered (dense) slot assignment: more readers
+// than slots must still work, and live threads get distinct dense indices
+// which are reused once threads exit.
+bool test_registered_slots() {
+  std::cout << "Testing registered slot assignment" << std::endl;
+
+  ResourceManager<std::string> manager(
+      std::make_unique<std::string>("Registered"),
+      ResourceManagerOptions{.epoch_slots = 4,
+                             .slot_assignment = SlotAssignment::Registered});
+
+  const size_t num_threads = 8;
+  for (int round = 0; round < 2; ++round) {
+    std::vector<size_t> indices(num_threads);
+    std::latch all_registered(num_threads);
+    std::atomic<size_t> total_length(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&, i]() {
+        indices[i] = ThreadIndex::dense();
+        all_registered.arrive_and_wait();
+        for (int j = 0; j < 10000; ++j) {
+          total_length.fetch_add(
+              manager.read([](const std::string &resource) {
+                return resource.length();
+              }),
+              std::memory_order_relaxed);
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    std::sort(indices.begin(), indices.end());
+    if (std::adjacent_find(indices.begin(), indices.end()) != indices.end()) {
+      std::cout << "Live threads share a dense index" << std::endl;
+      return false;
+    }
+    // Indices of exited threads are reused, only the main thread and the
+    // current batch can hold one:
+    if (indices.back() > num_threads) {
+      std::cout << "Dense index " << indices.back() << " was not reused"
+                << std::endl;
+      return false;
+    }
+    if (total_length.load() != num_threads * 10000 * 10) {
+      std::cout << "Unexpected total length " << total_length.load()
+                << std::endl;
+      return false;
+    }
+  }
+
+  std::cout << "Registered slot assignment test passed" << std::endl;
+  return true;
+}
+
+// Diagnostics are opt-in: the ThreadIndex logger sees new threads and the
+// slot logger sees readers which had to probe past their preferred slot.
+std::atomic<int> logged_assignments(0);
+std::atomic<int> logged_collisions(0);
+std::atomic<size_t> logged_preferred(0);
+std::atomic<size_t> logged_used(0);
+
+bool test_diagnostics_hooks() {
+  std::cout << "Testing diagnostics hooks" << std::endl;
+
+  ThreadIndex::set_logger([](char const *, size_t) {
+    logged_assignments.fetch_add(1, std::memory_order_relaxed);
+  });
+
+  // With hashed slot assignment the preferred slot is the ordinal modulo
+  // the number of slots. A holder whose ordinal is congruent to the one of
+  // the main thread occupies the main thread's preferred slot, so the main
+  // thread has to probe to the next one. A thread in between makes sure
+  // that there are at least two slots.
+  size_t const main_ordinal = ThreadIndex::ordinal();
+  std::thread([]() { ThreadIndex::ordinal(); }).join();
+  std::atomic<size_t> holder_ordinal{0};
+  std::atomic<int> stage{0};
+  std::unique_ptr<ResourceManager<std::string>> manager;
+  std::thread holder([&]() {
+    holder_ordinal.store(ThreadIndex::ordinal());
+    stage.store(1);
+    while (stage.load() != 2) {
+      std::this_thread::yield();
+    }
+    auto guard = manager->pin();
+    stage.store(3);
+    while (stage.load() != 4) {
+      std::this_thread::yield();
+    }
+  });
+  while (stage.load() != 1) {
+    std::this_thread::yield();
+  }
+  size_t const slots = holder_ordinal.load() - main_ordinal;
+  manager = std::make_unique<ResourceManager<std::string>>(
+      std::make_unique<std::string>("Diagnostics"),
+      ResourceManagerOptions{.epoch_slots = slots,
+                             .slot_logger = [](size_t preferred, size_t used) {
+                               logged_preferred.store(preferred);
+                               logged_used.store(used);
+                               logged_collisions.fetch_add(1);
+                             }});
+  stage.store(2);
+  while (stage.load() != 3) {
+    std::this_thread::yield();
+  }
+  manager->read([](const std::string &) {});
+  stage.store(4);
+  holder.join();
+  ThreadIndex::set_logger(nullptr);
+
+  if (logged_assignments.load() == 0) {
+    std::cout << "No thread index assignment was logged" << std::endl;
+    return false;
+  }
+  size_t const preferred = main_ordinal % slots;
+  if (logged_collisions.load() != 1 || logged_preferred.load() != preferred ||
+      logged_used.load() != (preferred + 1) % slots) {
+    std::cout << "Expected one collision from slot " << preferred
+              << ", logged " << logged_collisions.load() << ", the last from "
+              << logged_preferred.load() << " to " << logged_used.load()
+              << std::endl;
+    return false;
+  }
+  std::cout << "Logged " << logged_assignments.load() << " assignments and "
+            << logged_collisions.load() << " collision" << std::endl;
+  std::cout << "Diagnostics hooks test passed" << std::endl;
+  return true;
+}
+
+// A resource which poisons itself on destruction, so readers which see a
+// reclaimed resource are likely to notice.
+struct Checked {
+  static constexpr uint64_t ALIVE = 0x5ca1ab1e5ca1ab1e;
+  uint64_t magic = ALIVE;
+  uint64_t value;
+  explicit Checked(uint64_t v) : value(v) {}
+  ~Checked() { magic = 0; }
+};
+
+// Run readers with the given protocol against a writer which reclaims
+// synchronously. More readers than owned slots exercise the overflow slots,
+// nested reads must reuse the outer announcement. With `numa` the slots are
+// split over two nodes, which need not exist, and readers read the replicas.
+bool test_read_protocol(ReadProtocol protocol, char const *name,
+                        bool numa = false) {
+  std::cout << "Testing read protocol " << name << std::endl;
+
+  ResourceManager<Checked> manager(
+      std::make_unique<Checked>(0),
+      ResourceManagerOptions{.epoch_slots = 2,
+                             .slot_assignment = SlotAssignment::Registered,
+                             .read_protocol = protocol,
+                             .overflow_slots = 2,
+                             .numa = numa,
+                             .numa_nodes = 2,
+                             .numa_replicas = numa});
+  if (manager.stats().numa_nodes != (numa ? 2 : 1)) {
+    std::cout << "Unexpected number of NUMA nodes" << std::endl;
+    return false;
+  }
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> failures(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        bool ok = manager.read([&manager](const Checked &outer) {
+          bool nested_ok = manager.read([](const Checked &inner) {
+            return inner.magic == Checked::ALIVE;
+          });
+          return nested_ok && outer.magic == Checked::ALIVE;
+        });
+        if (!ok) {
+          failures.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    });
+  }
+
+  for (uint64_t i = 1; i <= 2000; ++i) {
+    auto [old_value, epoch] = manager.update(std::make_unique<Checked>(i));
+    manager.wait_reclaim(epoch);
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &thread : readers) {
+    thread.join();
+  }
+
+  if (failures.load() != 0) {
+    std::cout << "Readers saw " << failures.load() << " reclaimed resources"
+              << std::endl;
+    return false;
+  }
+  auto value = manager.read([](const Checked &c) { return c.value; });
+  if (value != 2000) {
+    std::cout << "Unexpected value " << value << std::endl;
+    return false;
+  }
+  std::cout << "Read protocol " << name << " test passed" << std::endl;
+  return true;
+}
+
+// A pinned resource blocks its reclamation until the guard is released,
+// moving the guard keeps the pin.
+bool test_read_guard() {
+  std::cout << "Testing read guards" << std::endl;
+
+  ResourceManager<std::string> manager(
+      std::make_unique<std::string>("Pinned"));
+
+  auto guard = manager.pin();
+  if (!guard || *guard != "Pinned" || guard->length() != 6) {
+    std::cout << "Guard does not point to the current resource" << std::endl;
+    return false;
+  }
+
+  auto [old_value, epoch] =
+      manager.update(std::make_unique<std::string>("Unpinned"));
+  auto moved = std::move(guard);
+  if (guard || manager.try_reclaim(epoch)) {
+    std::cout << "Moved guard lost its pin" << std::endl;
+    return false;
+  }
+
+  moved.reset();
+  if (!manager.try_reclaim(epoch)) {
+    std::cout << "Released guard still blocks reclamation" << std::endl;
+    return false;
+  }
+
+  // Results of try_read need not be default constructible:
+  struct NoDefault {
+    explicit NoDefault(size_t n) : length(n) {}
+    size_t length;
+  };
+  auto result = manager.try_read(
+      [](const std::string &resource) { return NoDefault(resource.length()); });
+  if (!result || result->length != 8) {
+    std::cout << "Unexpected read result" << std::endl;
+    return false;
+  }
+
+  // Without a resource the reader is not called: the result of read is
+  // default constructed, try_read returns nothing and modify publishes
+  // nothing.
+  ResourceManager<std::string> empty{std::unique_ptr<std::string>()};
+  if (empty.read([](const std::string &) { return size_t{1}; }) != 0) {
+    std::cout << "Read without a resource called the reader" << std::endl;
+    return false;
+  }
+  if (empty.try_read([](const std::string &resource) {
+        return NoDefault(resource.length());
+      }) ||
+      empty.modify([](std::string &resource) { resource += "?"; }) != 0 ||
+      empty.current_version() != 1) {
+    std::cout << "Access without a resource called the reader" << std::endl;
+    return false;
+  }
+
+  // Internally synchronized resources are modified in place:
+  manager.read_mut([](std::string &resource) { resource += "!"; });
+  if (manager.read([](const std::string &r) { return r; }) != "Unpinned!") {
+    std::cout << "Mutable read did not modify the resource" << std::endl;
+    return false;
+  }
+
+  std::cout << "Read guard test passed" << std::endl;
+  return true;
+}
+
+// With a single slot, a nested read can only succeed by reusing the outer
+// announcement. Several managers can be pinned at the same time.
+bool test_nested_reads() {
+  std::cout << "Testing nested reads" << std::endl;
+
+  ResourceManager<std::string> names(std::make_unique<std::string>("Nested"),
+                                     ResourceManagerOptions{.epoch_slots = 1});
+  ResourceManager<int> numbers(std::make_unique<int>(42),
+                               ResourceManagerOptions{.epoch_slots = 1});
+
+  size_t length = names.read([&names](const std::string &outer) {
+    return names.read([&outer](const std::string &inner) {
+      return outer.length() + inner.length();
+    });
+  });
+  if (length != 12) {
+    std::cout << "Unexpected nested read result " << length << std::endl;
+    return false;
+  }
+
+  std::unique_ptr<std::string> retired; // must outlive the pins
+  {
+    auto [name, number] = pin_all(names, numbers);
+    auto inner = names.pin();
+    if (*name != "Nested" || *number != 42 || inner.get() != name.get()) {
+      std::cout << "Unexpected pinned values" << std::endl;
+      return false;
+    }
+    auto [old_value, epoch] =
+        names.update(std::make_unique<std::string>("Updated"));
+    retired = std::move(old_value);
+    inner.reset();
+    if (names.try_reclaim(epoch)) {
+      std::cout << "Releasing a nested guard dropped the outer pin"
+                << std::endl;
+      return false;
+    }
+  }
+
+  // All pins are gone, so the single slots must be free again:
+  std::thread other([&names, &numbers]() {
+    names.read([](const std::string &) {});
+    numbers.read([](int) {});
+  });
+  other.join();
+
+  std::cout << "Nested reads test passed" << std::endl;
+  return true;
+}
+
+// A thread tracks only ThreadPins::CAPACITY pinned domains. Reads of
+// further domains are not tracked, so with a store based protocol they must
+// not share the owned slot: a nested read would overwrite the outer
+// announcement and clear it when it is done.
+bool test_untracked_pins() {
+  std::cout << "Testing untracked pins" << std::endl;
+
+  ResourceManagerOptions options{.slot_assignment = SlotAssignment::Registered,
+                                 .read_protocol = ReadProtocol::StoreFence};
+  std::vector<std::unique_ptr<ResourceManager<int>>> managers;
+  for (size_t i = 0; i <= ThreadPins::CAPACITY; ++i) {
+    managers.push_back(std::make_unique<ResourceManager<int>>(
+        std::make_unique<int>(static_cast<int>(i)), options));
+  }
+
+  std::unique_ptr<int> retired; // must outlive the pins
+  uint64_t retire_epoch = 0;
+  {
+    std::vector<ResourceManager<int>::ReadGuard> guards;
+    for (auto &manager : managers) {
+      guards.push_back(manager->pin());
+    }
+    auto &untracked = *managers.back();
+    auto inner = untracked.pin();
+    auto [old_value, epoch] = untracked.update(std::make_unique<int>(-1));
+    retired = std::move(old_value);
+    retire_epoch = epoch;
+    inner.reset();
+    if (untracked.try_reclaim(epoch)) {
+      std::cout << "A nested read of an untracked domain dropped the outer "
+                   "announcement"
+                << std::endl;
+      return false;
+    }
+    if (*guards.back() != static_cast<int>(ThreadPins::CAPACITY)) {
+      std::cout << "Unexpected pinned value" << std::endl;
+      return false;
+    }
+  }
+  if (!managers.back()->try_reclaim(retire_epoch)) {
+    std::cout << "Released pins still block reclamation" << std::endl;
+    return false;
+  }
+
+  std::cout << "Untracked pins test passed" << std::endl;
+  return true;
+}
+
+// Counts live instances, to check that no resource is leaked.
+struct Counted {
+  static inline std::atomic<int64_t> alive{0};
+  uint64_t value;
+  explicit Counted(uint64_t v) : value(v) { alive.fetch_add(1); }
+  ~Counted() { alive.fetch_sub(1); }
+};
+
+// Concurrent coalesced updates: the latest value of some writer wins and
+// every superseded or replaced resource is eventually freed.
+bool test_coalesced_updates() {
+  std::cout << "Testing coalesced updates" << std::endl;
+
+  const uint64_t num_writers = 4;
+  const uint64_t updates_per_writer = 5000;
+  {
+    ResourceManager<Counted> manager(std::make_unique<Counted>(0));
+    std::atomic<bool> stop(false);
+    std::thread reader([&]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        manager.read([](const Counted &c) { return c.value; });
+      }
+    });
+
+    std::vector<std::thread> writers;
+    for (uint64_t w = 0; w < num_writers; ++w) {
+      writers.emplace_back([&manager, w]() {
+        for (uint64_t i = 1; i <= updates_per_writer; ++i) {
+          manager.update_coalesced(
+              std::make_unique<Counted>(i * num_writers + w));
+        }
+      });
+    }
+    for (auto &thread : writers) {
+      thread.join();
+    }
+    stop.store(true, std::memory_order_relaxed);
+    reader.join();
+
+    // The very last update of some writer must have been published:
+    auto value = manager.read([](const Counted &c) { return c.value; });
+    if (value / num_writers != updates_per_writer) {
+      std::cout << "Unexpected value after coalesced updates: " << value
+                << std::endl;
+      return false;
+    }
+    manager.reclaim();
+    if (Counted::alive.load() != 1) {
+      std::cout << Counted::alive.load() << " resources alive, expected 1"
+                << std::endl;
+      return false;
+    }
+  }
+  if (Counted::alive.load() != 0) {
+    std::cout << "Leaked " << Counted::alive.load() << " resources"
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Coalesced updates test passed" << std::endl;
+  return true;
+}
+
+// Read-copy-update from several writers must not lose updates, and
+// unchanged shared members are shared between versions.
+bool test_modify() {
+  std::cout << "Testing modify" << std::endl;
+
+  struct Config {
+    uint64_t counter = 0;
+    std::shared_ptr<const std::vector<int>> table;
+  };
+  ResourceManager<Config> manager(std::make_unique<Config>(
+      Config{0, std::make_shared<const std::vector<int>>(1000, 7)}));
+  auto const *table = manager.read(
+      [](const Config &config) { return config.table.get(); });
+
+  const uint64_t num_writers = 4;
+  const uint64_t updates_per_writer = 1000;
+  std::vector<std::thread> writers;
+  for (uint64_t w = 0; w < num_writers; ++w) {
+    writers.emplace_back([&manager, w]() {
+      for (uint64_t i = 0; i < updates_per_writer; ++i) {
+        if (i % 2 == 0) {
+          manager.modify([](Config &config) { ++config.counter; });
+        } else {
+          manager.modify([](const Config &config) {
+            return std::make_unique<Config>(
+                Config{config.counter + 1, config.table});
+          });
+        }
+      }
+    });
+  }
+  for (auto &thread : writers) {
+    thread.join();
+  }
+
+  auto [counter, shared] = manager.read([](const Config &config) {
+    return std::pair(config.counter, config.table.get());
+  });
+  if (counter != num_writers * updates_per_writer || shared != table) {
+    std::cout << "Unexpected state after modify: counter " << counter
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Modify test passed" << std::endl;
+  return true;
+}
+
+// Waiting for a slow reader: the timed wait gives up, the untimed one parks
+// until the reader leaves.
+bool test_blocking_wait() {
+  std::cout << "Testing blocking wait_reclaim" << std::endl;
+
+  ResourceManager<std::string> manager(std::make_unique<std::string>("Slow"));
+  std::latch pinned(1);
+  std::thread reader([&]() {
+    manager.read([&pinned](const std::string &) {
+      pinned.count_down();
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    });
+  });
+  pinned.wait();
+
+  auto [old_value, epoch] =
+      manager.update(std::make_unique<std::string>("Fast"));
+  if (manager.try_reclaim(epoch) ||
+      manager.wait_reclaim_for(epoch, std::chrono::milliseconds(5))) {
+    std::cout << "Epoch reclaimable while the reader holds it" << std::endl;
+    reader.join();
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto cpu_start = std::clock();
+  manager.wait_reclaim(epoch);
+  auto waited = std::chrono::steady_clock::now() - start;
+  double cpu_ms = 1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+  reader.join();
+
+  double waited_ms =
+      std::chrono::duration<double, std::milli>(waited).count();
+  std::cout << "Waited " << waited_ms << " ms using " << cpu_ms << " ms CPU"
+            << std::endl;
+  // The reader sleeps, so the process CPU time is that of the waiter. A
+  // spinning waiter would use about as much CPU time as it waited, which is
+  // most of the 50 ms of the reader.
+  if (cpu_ms > std::max(waited_ms / 4, 5.0)) {
+    std::cout << "wait_reclaim did not park" << std::endl;
+    return false;
+  }
+  if (!manager.try_reclaim(epoch)) {
+    std::cout << "Epoch not reclaimable after wait_reclaim" << std::endl;
+    return false;
+  }
+
+  std::cout << "Blocking wait_reclaim test passed" << std::endl;
+  return true;
+}
+
+// With ThreadMetrics the manager counts collisions, probes and waits, with
+// NoMetrics it does not even store the counters.
+bool test_metrics() {
+  std::cout << "Testing metrics" << std::endl;
+
+  static_assert(std::is_empty_v<NoMetrics::Counters<ManagerCounter>>);
+  ResourceManager<std::string, ThreadMetrics> manager(
+      std::make_unique<std::string>("Metrics"),
+      ResourceManagerOptions{.epoch_slots = 1});
+
+  // A reader which holds the only slot makes the main thread probe.
+  std::latch pinned(1);
+  std::thread reader([&]() {
+    manager.read([&pinned](const std::string &) {
+      pinned.count_down();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    });
+  });
+  pinned.wait();
+  manager.read([](const std::string &) {});
+  reader.join();
+
+  auto [old_value, epoch] =
+      manager.update(std::make_unique<std::string>("Updated"));
+  manager.wait_reclaim(epoch);
+
+  ResourceManagerStats stats = manager.stats();
+  std::cout << "Reads: " << stats.reads
+            << ", collisions: " << stats.slot_collisions
+            << ", probe steps: " << stats.probe_steps
+            << ", max probe: " << stats.max_probe
+            << ", scans: " << stats.slot_scans
+            << ", waits: " << stats.reclaim_waits << " ("
+            << stats.reclaim_wait_ns << " ns)" << std::endl;
+  if (stats.reads != 2 || stats.slot_collisions != 1 ||
+      stats.probe_steps == 0 || stats.max_probe == 0 ||
+      stats.max_probe > stats.probe_steps || stats.slot_scans == 0 ||
+      stats.reclaim_waits != 1 || stats.global_epoch != 2 ||
+      stats.epoch_slots != 1) {
+    std::cout << "Unexpected metrics" << std::endl;
+    return false;
+  }
+
+  ResourceManager<std::string> plain(std::make_unique<std::string>("Off"));
+  plain.read([](const std::string &) {});
+  ResourceManagerStats off = plain.stats();
+  if (off.reads != 0 || off.global_epoch != 1) {
+    std::cout << "Unexpected metrics without ThreadMetrics" << std::endl;
+    return false;
+  }
+
+  std::cout << "Metrics test passed" << std::endl;
+  return true;
+}
+
+// Managers of one domain share the announcement, the slot table and the
+// reclamation.
+bool test_shared_domain() {
+  std::cout << "Testing shared epoch domain" << std::endl;
+
+  // With a single slot, a second announcement by the same thread would spin
+  // forever, so the nested reads below must reuse the pin.
+  auto domain = std::make_shared<EpochDomain<>>(
+      ResourceManagerOptions{.epoch_slots = 1});
+  ResourceManager<std::string> routes(std::make_unique<std::string>("Routes"),
+                                      domain);
+  ResourceManager<int> flags(std::make_unique<int>(7), domain);
+
+  {
+    auto guard = domain->pin();
+    auto pinned = pin_all(routes, flags);
+    size_t length = routes.read([&flags](const std::string &r) {
+      return r.length() + flags.read([](const int &f) { return f; });
+    });
+    if (length != 13 || *std::get<1>(pinned) != 7) {
+      std::cout << "Unexpected reads " << length << std::endl;
+      return false;
+    }
+  }
+
+  std::latch pinned(1);
+  std::latch release(1);
+  std::thread reader([&]() {
+    auto guard = domain->pin();
+    pinned.count_down();
+    release.wait();
+  });
+  pinned.wait();
+  routes.update_deferred(std::make_unique<std::string>("New routes"));
+  flags.update_deferred(std::make_unique<int>(8));
+  size_t pending = routes.pending_retirements();
+  release.count_down();
+  reader.join();
+  size_t freed = flags.reclaim();
+
+  ResourceManagerStats stats = routes.stats();
+  std::cout << "Pending " << pending << ", freed " << freed << " at epoch "
+            << stats.global_epoch << std::endl;
+  if (pending != 2 || freed != 2 || flags.pending_retirements() != 0 ||
+      stats.global_epoch != 3) {
+    std::cout << "Retirements were not shared" << std::endl;
+    return false;
+  }
+
+  std::cout << "Shared epoch domain test passed" << std::endl;
+  return true;
+}
+
+// A reader which holds an old resource keeps only that one alive under
+// hazard pointers, newer retirements are freed right away.
+bool test_hazard_pointers() {
+  std::cout << "Testing hazard pointers" << std::endl;
+
+  ResourceManager<Checked, NoMetrics, HazardDomain> manager(
+      std::make_unique<Checked>(1));
+  std::latch pinned(1);
+  std::latch release(1);
+  std::thread reader([&]() {
+    auto guard = manager.pin();
+    pinned.count_down();
+    release.wait();
+  });
+  pinned.wait();
+
+  auto [first, first_epoch] = manager.update(std::make_unique<Checked>(2));
+  manager.retire(std::move(first), first_epoch);
+  auto [second, second_epoch] = manager.update(std::make_unique<Checked>(3));
+  manager.retire(std::move(second), second_epoch);
+  bool held = !manager.try_reclaim(first_epoch);
+  bool passed = manager.try_reclaim(second_epoch);
+  size_t freed = manager.reclaim();
+  size_t pending = manager.pending_retirements();
+  release.count_down();
+  reader.join();
+  std::cout << "Freed " << freed << " with " << pending
+            << " held by the reader" << std::endl;
+  if (!held || !passed || freed != 1 || pending != 1 ||
+      manager.reclaim() != 1 || !manager.try_reclaim(first_epoch)) {
+    std::cout << "Held resource did not bound the garbage" << std::endl;
+    return false;
+  }
+
+  // Concurrent readers, every nested read protects its pointer in a slot
+  // of its own.
+  ResourceManager<Checked, NoMetrics, HazardDomain> checked(
+      std::make_unique<Checked>(0),
+      ResourceManagerOptions{.epoch_slots = 8});
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> failures(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        bool ok = checked.read([&checked](const Checked &outer) {
+          bool nested_ok = checked.read([](const Checked &inner) {
+            return inner.magic == Checked::ALIVE;
+          });
+          return nested_ok && outer.magic == Checked::ALIVE;
+        });
+        if (!ok) {
+          failures.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    });
+  }
+  for (uint64_t i = 1; i <= 2000; ++i) {
+    auto [old_value, epoch] = checked.update(std::make_unique<Checked>(i));
+    checked.wait_reclaim(epoch);
+  }
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &thread : readers) {
+    thread.join();
+  }
+  if (failures.load() != 0) {
+    std::cout << "Readers saw " << failures.load() << " reclaimed resources"
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Hazard pointers test passed" << std::endl;
+  return true;
+}
+
+// Under QSBR a retirement waits for the online participants to pass a
+// quiescent state, offline participants are not waited for.
+bool test_quiescent_states() {
+  std::cout << "Testing quiescent states" << std::endl;
+
+  auto domain = std::make_shared<QuiescentDomain<>>(
+      ResourceManagerOptions{.epoch_slots = 2});
+  ResourceManager<Checked, NoMetrics, QuiescentDomain> manager(
+      std::make_unique<Checked>(1), domain);
+  std::latch pinned(1);
+  std::latch release(1);
+  std::thread reader([&]() {
+    auto participant = domain->join();
+    manager.read([](const Checked &) {});
+    pinned.count_down();
+    release.wait();
+    participant.quiescent();
+  });
+  pinned.wait();
+
+  bool full = false;
+  {
+    auto offline = domain->join();
+    offline.offline();
+    try {
+      auto third = domain->join();
+    } catch (std::runtime_error const &) {
+      full = true;
+    }
+  }
+  auto [old_value, epoch] = manager.update(std::make_unique<Checked>(2));
+  if (!full || manager.try_reclaim(epoch) ||
+      manager.wait_reclaim_for(epoch, std::chrono::milliseconds(5))) {
+    std::cout << "Epoch reclaimable before the quiescent state" << std::endl;
+    release.count_down();
+    reader.join();
+    return false;
+  }
+  release.count_down();
+  manager.wait_reclaim(epoch);
+  reader.join();
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> failures(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 2; ++i) {
+    readers.emplace_back([&]() {
+      auto participant = domain->join();
+      while (!stop.load(std::memory_order_relaxed)) {
+        bool ok = manager.read(
+            [](const Checked &c) { return c.magic == Checked::ALIVE; });
+        if (!ok) {
+          failures.fetch_add(1, std::memory_order_relaxed);
+        }
+        participant.quiescent();
+      }
+    });
+  }
+  for (uint64_t i = 3; i <= 2000; ++i) {
+    manager.update_deferred(std::make_unique<Checked>(i));
+  }
+  auto [last, last_epoch] = manager.update(std::make_unique<Checked>(2001));
+  manager.wait_reclaim(last_epoch);
+  manager.reclaim();
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &thread : readers) {
+    thread.join();
+  }
+  if (failures.load() != 0 || manager.pending_retirements() != 0) {
+    std::cout << "Readers saw " << failures.load() << " reclaimed resources, "
+              << manager.pending_retirements() << " pending" << std::endl;
+    return false;
+  }
+
+  std::cout << "Quiescent states test passed" << std::endl;
+  return true;
+}
+
+// Retained versions can be read by number until they fall out of the ring.
+bool test_versions() {
+  std::cout << "Testing retained versions" << std::endl;
+
+  ResourceManager<Checked> manager(
+      std::make_unique<Checked>(1),
+      ResourceManagerOptions{.retained_versions = 2});
+  bool filling = true;
+  for (uint64_t i = 2; i <= 3; ++i) {
+    auto [evicted, epoch] = manager.update(std::make_unique<Checked>(i));
+    filling = filling && evicted == nullptr;
+  }
+  auto [evicted, epoch] = manager.update(std::make_unique<Checked>(4));
+  auto [guard, version] = manager.pin_version();
+  bool expired = false;
+  try {
+    manager.read_at(1, [](const Checked &) {});
+  } catch (std::out_of_range const &) {
+    expired = true;
+  }
+  if (!filling || evicted == nullptr || evicted->value != 1 || !expired ||
+      manager.read_at(2, [](const Checked &c) { return c.value; }) != 2 ||
+      manager.pin_at(5) || version != 4 || guard->value != 4 ||
+      manager.current_version() != 4) {
+    std::cout << "Unexpected versions" << std::endl;
+    return false;
+  }
+  guard.reset();
+
+  // Readers stay on a version for several reads while the writer moves on.
+  // Every version they get must be the one they asked for.
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> failures(0);
+  std::atomic<uint64_t> expirations(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t version = manager.pin_version().second;
+        for (int j = 0; j < 4; ++j) {
+          try {
+            bool ok = manager.read_at(version, [version](const Checked &c) {
+              return c.magic == Checked::ALIVE && c.value == version;
+            });
+            if (!ok) {
+              failures.fetch_add(1, std::memory_order_relaxed);
+            }
+          } catch (std::out_of_range const &) {
+            expirations.fetch_add(1, std::memory_order_relaxed);
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (uint64_t i = 5; i <= 2000; ++i) {
+    manager.update_deferred(std::make_unique<Checked>(i));
+  }
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &thread : readers) {
+    thread.join();
+  }
+  std::cout << expirations.load() << " versions expired during a computation"
+            << std::endl;
+  if (failures.load() != 0) {
+    std::cout << "Readers got " << failures.load() << " wrong versions"
+              << std::endl;
+    return false;
+  }
+
+  std::cout << "Retained versions test passed" << std::endl;
+  return true;
+}
+
+// Minimal coroutine type which runs eagerly and cleans up after itself.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// A coroutine waiting for an epoch is suspended while a reader holds it and
+// resumed by reclaim() or by the background reclaimer.
+bool test_reclaimed() {
+  std::cout << "Testing coroutine wait for reclamation" << std::endl;
+
+  ResourceManager<std::string> manager(std::make_unique<std::string>("v1"));
+  std::atomic<bool> resumed(false);
+  std::atomic<std::thread::id> resumed_on;
+  auto waiter = [&](uint64_t epoch) -> Detached {
+    co_await manager.reclaimed(epoch);
+    resumed_on = std::this_thread::get_id();
+    resumed = true;
+  };
+
+  // Nobody reads, so the coroutine does not even suspend.
+  waiter(manager.update(std::make_unique<std::string>("v2")).second);
+  if (!resumed) {
+    std::cout << "Coroutine suspended for a reclaimable epoch" << std::endl;
+    return false;
+  }
+
+  for (bool background : {false, true}) {
+    resumed = false;
+    std::latch pinned(1);
+    std::latch release(1);
+    std::thread reader([&]() {
+      auto guard = manager.pin();
+      pinned.count_down();
+      release.wait();
+    });
+    pinned.wait();
+    if (background) {
+      manager.start_reclaimer();
+    }
+    auto [old_value, epoch] =
+        manager.update(std::make_unique<std::string>("v3"));
+    waiter(epoch);
+    manager.reclaim();
+    bool early = resumed;
+    release.count_down();
+    reader.join();
+    if (!background) {
+      manager.reclaim();
+    }
+    for (int i = 0; i < 1000 && !resumed; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    manager.stop_reclaimer();
+    if (early || !resumed ||
+        (background && resumed_on.load() == std::this_thread::get_id())) {
+      std::cout << "Coroutine not resumed as expected"
+                << (background ? " by the reclaimer" : "") << std::endl;
+      return false;
+    }
+  }
+
+  std::cout << "Coroutine wait for reclamation test passed" << std::endl;
+  return true;
+}
+
 int main() {
   std::cout << "Testing ResourceManager with strings" << std::endl;
 
@@ -134,5 +1144,22 @@ int main() {
   std::cout << "Total reads: " << completed_reads.load() << std::endl;
   std::cout << "Total updates: " << completed_updates.load() << std::endl;
 
+  if (!test_deferred_reclamation() || !test_registered_slots() ||
+      !test_diagnostics_hooks() || !test_read_guard() ||
+      !test_nested_reads() || !test_untracked_pins() ||
+      !test_coalesced_updates() || !test_modify() ||
+      !test_blocking_wait() || !test_metrics() || !test_shared_domain() ||
+      !test_hazard_pointers() || !test_quiescent_states() ||
+      !test_versions() || !test_reclaimed() ||
+      !test_read_protocol(ReadProtocol::CompareExchange, "CompareExchange") ||
+      !test_read_protocol(ReadProtocol::StoreFence, "StoreFence") ||
+      !test_read_protocol(ReadProtocol::Asymmetric, "Asymmetric") ||
+      !test_read_protocol(ReadProtocol::CompareExchange,
+                          "CompareExchange (NUMA)", true) ||
+      !test_read_protocol(ReadProtocol::StoreFence, "StoreFence (NUMA)",
+                          true)) {
+    return 1;
+  }
+
   return 0;
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#include "ResourceManager.h"
+
+namespace arangodb {
+
+// The class RingBoundedList is a bounded list for small, fixed-size records
+// which does not use linked lists at all. All entries live in a
+// preallocated ring of `capacity` slots (rounded up to a power of two). A
+// writer draws a ticket with a single fetch_add, which determines its slot,
+// and copies the record there, so prepend never allocates and memory usage
+// is constant. Once the ring is full, every prepend overwrites the oldest
+// entry.
+// Every slot carries a sequence number which works like a seqlock: it is
+// odd while the slot is written and 2 * (ticket + 1) once the record of
+// `ticket` is complete. forItems walks the tickets from newest to oldest,
+// skips entries which are still being written and stops at the first one
+// which has been overwritten by a newer round, so it sees a consistent
+// snapshot of the most recent entries without taking any lock.
+// The type T must be trivially copyable, since readers copy records which
+// might be overwritten concurrently and detect this only afterwards.
+// A prepend does not block other writers, unless a writer is lapped by
+// `capacity` prepends while it copies its record: then the writer of the
+// next round for that slot has to wait for it. It spins for a short while
+// and then yields until the slot is free, so a preempted writer costs CPU
+// time, but does not keep its successor spinning on the core it needs.
+template <typename T> class RingBoundedList {
+private:
+  static_assert(std::is_trivially_copyable_v<T>,
+                "T must be trivially copyable");
+
+  static constexpr size_t WORDS =
+      (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    // The record, see `storeRecord`
+    std::atomic<uint64_t> words[WORDS];
+  };
+
+  // A reader may copy a record while a writer overwrites it. To make this
+  // well defined, records are copied word by word with relaxed atomics
+  // (Boehm, "Can seqlocks get along with programming language memory
+  // models?"): the reader can get a torn copy, but there is no data race,
+  // and the sequence number, which is ordered around the copy by fences,
+  // tells the reader to throw such a copy away.
+  static void storeRecord(Slot &slot, T const &value) noexcept {
+    uint64_t buffer[WORDS] = {};
+    std::memcpy(buffer, &value, sizeof(T));
+    for (size_t i = 0; i < WORDS; ++i) {
+      slot.words[i].store(buffer[i], std::memory_order_relaxed);
+    }
+  }
+
+  static void loadRecord(Slot const &slot, unsigned char *out) noexcept {
+    uint64_t buffer[WORDS];
+    for (size_t i = 0; i < WORDS; ++i) {
+      buffer[i] = slot.words[i].load(std::memory_order_relaxed);
+    }
+    std::memcpy(out, buffer, sizeof(T));
+  }
+
+  static size_t roundCapacity(size_t capacity) {
+    if (capacity == 0) {
+      throw std::invalid_argument("RingBoundedList: capacity must be > 0");
+    }
+    return std::bit_ceil(capacity);
+  }
+
+  // Spins of a writer on a slot which is still written, before it yields
+  static constexpr int SLOT_SPINS = 128;
+
+  alignas(64) std::atomic<uint64_t> _ticket{0};
+  alignas(64) const size_t _capacity;
+  const size_t _mask;
+  std::unique_ptr<Slot[]> _slots;
+
+public:
+  explicit RingBoundedList(size_t capacity)
+      : _capacity(roundCapacity(capacity)), _mask(_capacity - 1),
+        _slots(std::make_unique<Slot[]>(_capacity)) {}
+
+  // Same memory budget as a BoundedList with these arguments would have.
+  RingBoundedList(std::size_t memoryThreshold, std::size_t maxHistory)
+      : RingBoundedList(memoryThreshold * maxHistory / sizeof(Slot)) {}
+
+  size_t capacity() const noexcept { return _capacity; }
+
+  void prepend(T &&value) noexcept {
+    uint64_t ticket = _ticket.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = _slots[ticket & _mask];
+
+    // The writer of the previous round must have finished with this slot.
+    // This only waits if a writer got lapped by `capacity` prepends while
+    // copying its record, see above.
+    uint64_t previous = ticket >= _capacity ? 2 * (ticket - _capacity + 1) : 0;
+    int spins = 0;
+    while (slot.seq.load(std::memory_order_acquire) != previous) {
+      if (spins < SLOT_SPINS) {
+        ++spins;
+        cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+
+    slot.seq.store(2 * ticket + 1, std::memory_order_relaxed);
+    // The odd sequence number must be visible before any word of the record
+    // changes, this pairs with the acquire fence in forItems.
+    std::atomic_thread_fence(std::memory_order_release);
+    storeRecord(slot, value);
+    slot.seq.store(2 * (ticket + 1), std::memory_order_release);
+  }
+
+  template <typename F>
+    requires std::is_invocable_v<F, T const &>
+  void forItems(F &&callback) const {
+    uint64_t end = _ticket.load(std::memory_order_acquire);
+    uint64_t begin = end > _capacity ? end - _capacity : 0;
+
+    alignas(T) unsigned char copy[sizeof(T)];
+    for (uint64_t ticket = end; ticket-- > begin;) {
+      Slot const &slot = _slots[ticket & _mask];
+      uint64_t before = slot.seq.load(std::memory_order_acquire);
+      if (before < 2 * (ticket + 1)) {
+        continue; // still being written, not part of the snapshot
+      }
+      if (before > 2 * (ticket + 1)) {
+        return; // overwritten, and so is everything older
+      }
+      loadRecord(slot, copy);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != before) {
+        return; // overwritten while we copied it
+      }
+      callback(*std::launder(reinterpret_cast<T const *>(copy)));
+    }
+  }
+
+  // There is nothing to free, only here for interface compatibility with
+  // the other bounded lists.
+  size_t clearTrash() { return 0; }
+};
+
+} // namespace arangodb
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#endif
+
+#include "AtomicList.h"
+#include "ListHistory.h"
+#include "ResourceManager.h"
+
+namespace arangodb {
+
+// The class ShardedBoundedList is a variant of BoundedList2 for many
+// concurrent writers. Instead of a single AtomicList, the current
+// "generation" consists of one AtomicList per shard, and every thread
+// prepends to the shard given by its dense thread index, so writers on
+// different shards never touch the same list head. Memory usage is counted
+// per shard as well and only folded into the generation's total in
+// quanta of _memoryThreshold / (4 * shards), so the shared counter is
+// touched rarely. This means the threshold can be overshot by up to a
+// quarter before the lists are rotated.
+// Rotation, the ring buffer of historic generations, the published view
+// for readers and the trash work as in BoundedList2 (see ListHistory), the
+// total upper limit for the memory usage is thus about
+//   _memoryThreshold * _maxHistory.
+// Like there, rotation does not wait for writers to leave the old
+// generation, and forItems neither takes a lock nor allocates (unless there
+// are more than 64 shards).
+// With Arena = true every writer thread additionally holds a chunk of
+// AtomicList::ARENA_CHUNK_BYTES (16 KiB) per generation it writes to, which
+// is not counted against the threshold.
+// Items carry a time stamp, and forItems merges the shards of a generation
+// by it, so items are delivered newest first. Items prepended concurrently
+// to the same shard can appear slightly out of order. For the same reason
+// there are no sequence numbers, so unlike the other bounded lists this one
+// offers neither `forItems(since, limit, callback)` nor `exportItems`.
+// The type T must be an object which has a move constructor and has
+// a method called `memoryUsage` which estimates the memory usage
+// (including all substructures) in bytes.
+template <typename T, bool Arena = false, typename Metrics = NoMetrics>
+class ShardedBoundedList {
+private:
+  static_assert(std::is_object_v<T>, "T must be an object type");
+  static_assert(
+      std::is_same_v<decltype(std::declval<T>().memoryUsage()), size_t>,
+      "T must have a memoryUsage() method returning size_t");
+
+  struct Item {
+    uint64_t stamp;
+    T data;
+  };
+
+  using ShardList = AtomicList<Item, Arena>;
+  using Node = typename ShardList::Node;
+
+  struct alignas(64) Shard {
+    // The list accounts the exact memory usage of the shard
+    ShardList list;
+  };
+
+  // The lists of all shards, which ListHistory handles like one list.
+  struct Generation {
+    explicit Generation(size_t numShards) : shards(numShards) {}
+    std::vector<Shard> shards;
+    // Usage folded in from the shards in whole quanta
+    alignas(64) std::atomic<std::size_t> folded{0};
+
+    size_t memoryUsage() const noexcept {
+      size_t bytes = 0;
+      for (Shard const &shard : shards) {
+        bytes += shard.list.memoryUsage();
+      }
+      return bytes;
+    }
+
+    size_t releaseNodes(size_t maxNodes) {
+      size_t freed = 0;
+      for (Shard &shard : shards) {
+        if (freed >= maxNodes) {
+          break;
+        }
+        freed += shard.list.releaseNodes(maxNodes - freed);
+      }
+      return freed;
+    }
+
+    bool empty() const noexcept {
+      return std::ranges::all_of(
+          shards, [](Shard const &shard) { return shard.list.empty(); });
+    }
+  };
+
+  using History = ListHistory<Generation, Metrics>;
+
+  // Number of shards for which forItems keeps its cursors on the stack
+  static constexpr size_t INLINE_SHARDS = 64;
+
+  // Monotonic time stamp to order items across shards. The TSC is
+  // synchronized across cores on all CPUs we care about.
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+  }
+
+  // ResourceManager for the current generation, it owns the generation
+  // until rotation moves it into the ring buffer
+  ResourceManager<Generation, Metrics> _resourceManager;
+
+  char padding[64]; // Put subsequent entries on a different cache line
+  std::atomic<bool> _isRotating{false}; // Flag to coordinate rotation
+
+  // Ring buffer for historic generations, view for readers and trash
+  History _history;
+
+  // Configuration
+  const std::size_t _memoryThreshold;
+  const std::size_t _maxHistory;
+  const std::size_t _numShards;
+  const std::size_t _foldQuantum;
+
+  static size_t defaultShards() {
+    size_t n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+  }
+
+public:
+  // numShards == 0 means one shard per hardware thread.
+  ShardedBoundedList(std::size_t memoryThreshold, std::size_t maxHistory,
+                     std::size_t numShards = 0)
+      : ShardedBoundedList(
+            memoryThreshold, maxHistory,
+            new Generation(numShards == 0 ? defaultShards() : numShards)) {}
+
+private:
+  ShardedBoundedList(std::size_t memoryThreshold, std::size_t maxHistory,
+                     Generation *initial)
+      : _resourceManager(
+            std::unique_ptr<Generation>(initial),
+            ResourceManagerOptions{.slot_assignment =
+                                       SlotAssignment::Registered}),
+        _history(maxHistory, initial,
+                 [this](uint64_t epoch) {
+                   return _resourceManager.try_reclaim(epoch);
+                 }),
+        _memoryThreshold(memoryThreshold), _maxHistory(maxHistory),
+        _numShards(initial->shards.size()),
+        _foldQuantum(
+            std::max<std::size_t>(1, memoryThreshold / (4 * _numShards))) {
+    // The constructor exception could be more specific:
+    if (memoryThreshold == 0 || maxHistory < 2) {
+      throw std::invalid_argument(
+          "ShardedBoundedList: memoryThreshold must be > 0 and maxHistory "
+          "must be >= 2");
+    }
+  }
+
+public:
+  void prepend(T &&value) {
+    // Can throw in out of memory situations!
+    auto mem_usage = value.memoryUsage();
+    size_t shardIndex = ThreadIndex::dense() % _numShards;
+
+    // The generation is internally synchronized, see BoundedList2. The
+    // result is the generation if this prepend filled it up.
+    Generation *full = _resourceManager.read_mut(
+        [&](Generation &current) -> Generation * {
+          // Only threads on the same shard contend on its list:
+          size_t after = current.shards[shardIndex].list.prepend(
+              Item{now(), std::move(value)}, mem_usage);
+          // Every quantum which the shard's usage crosses is folded into the
+          // generation's total by the thread which crossed it. A dropped
+          // item can only make a fold come early.
+          size_t before = after - std::min(after, mem_usage);
+          size_t crossed = after / _foldQuantum - before / _foldQuantum;
+          if (crossed == 0) {
+            return nullptr;
+          }
+          size_t folded = crossed * _foldQuantum;
+          size_t newUsage =
+              current.folded.fetch_add(folded, std::memory_order_relaxed) +
+              folded;
+          return newUsage >= _memoryThreshold ? &current : nullptr;
+        });
+
+    if (full != nullptr) {
+      tryRotateLists(full);
+    }
+  }
+
+  // A writer which finds the list full while another thread rotates it backs
+  // off for a bounded time, see ListHistory::awaitRotation.
+  void awaitRotation() const { History::awaitRotation(_isRotating); }
+
+  // Try to rotate lists, if `expectedCurrent` is still the current
+  // generation. Only the thread which takes the rotation flag rotates, the
+  // others back off for a while, see `awaitRotation`.
+  void tryRotateLists(Generation *expectedCurrent) {
+    // Only one thread does the rotation, see BoundedList2.
+    if (_isRotating.load(std::memory_order_relaxed)) {
+      awaitRotation();
+      return;
+    }
+    bool expected = false;
+    if (!_isRotating.compare_exchange_strong(expected, true,
+                                             std::memory_order_relaxed,
+                                             std::memory_order_relaxed)) {
+      // Another thread is already handling rotation
+      awaitRotation();
+      return;
+    }
+
+    // A writer which was delayed after its prepend finds the old generation
+    // full, also once it has been rotated out. It must not rotate the new,
+    // almost empty one, see BoundedList2.
+    bool stale = _resourceManager.read(
+        [expectedCurrent](Generation const &current) {
+          return &current != expectedCurrent;
+        });
+    if (stale) {
+      _isRotating.store(false, std::memory_order_release);
+      return;
+    }
+
+    // Update the current generation using ResourceManager
+    auto newGeneration = std::make_unique<Generation>(_numShards);
+    Generation *newCurrent = newGeneration.get();
+    auto [oldGeneration, epoch] =
+        _resourceManager.update(std::move(newGeneration));
+
+    // Writers might still prepend to the old generation, as in BoundedList2
+    // the epoch keeps it from being freed before they have left.
+    _history.rotate(std::shared_ptr<Generation>(std::move(oldGeneration)),
+                    newCurrent, epoch);
+
+    // Release the rotation lock
+    _isRotating.store(false, std::memory_order_release);
+  }
+
+  template <typename F>
+    requires std::is_invocable_v<F, T const &>
+  void forItems(F &&callback) const {
+    // One cursor per shard, reused for all generations
+    std::array<Node *, INLINE_SHARDS> inlineCursors;
+    std::unique_ptr<Node *[]> heapCursors;
+    Node **cursors = inlineCursors.data();
+    if (_numShards > INLINE_SHARDS) {
+      heapCursors = std::make_unique<Node *[]>(_numShards);
+      cursors = heapCursors.get();
+    }
+
+    // Process generations from newest to oldest, merging the shards of each
+    // generation by time stamp.
+    _history.forLists([&](Generation const &generation) {
+      for (size_t i = 0; i < _numShards; ++i) {
+        cursors[i] = generation.shards[i].list.getSnapshot();
+      }
+      while (true) {
+        Node **newest = nullptr;
+        for (size_t i = 0; i < _numShards; ++i) {
+          if (cursors[i] != nullptr &&
+              (newest == nullptr ||
+               cursors[i]->_data.stamp > (*newest)->_data.stamp)) {
+            newest = &cursors[i];
+          }
+        }
+        if (newest == nullptr) {
+          break;
+        }
+        callback((*newest)->_data.data);
+        *newest = (*newest)->next();
+      }
+    });
+  }
+
+  size_t clearTrash() { return _history.clearTrash(); }
+
+  // Incremental freeing of the trash, see ListHistory.
+  size_t reclaimStep(size_t maxNodes) { return _history.reclaimStep(maxNodes); }
+  void startReclaimer(TrashReclaimerOptions options = {}) {
+    _history.startReclaimer(options);
+  }
+  void stopReclaimer() { _history.stopReclaimer(); }
+  size_t pendingTrashBytes() const noexcept { return _history.pendingBytes(); }
+  size_t pendingTrashLists() const noexcept { return _history.pendingLists(); }
+
+  // Rotations, freed lists and nodes (with `Metrics = ThreadMetrics`) and
+  // the current memory usage, see BoundedList2.
+  ListHistoryStats stats() const {
+    ListHistoryStats result = _history.stats();
+    result.memory_threshold = _memoryThreshold;
+    return result;
+  }
+
+  // Slot collisions and probe lengths of the writers.
+  ResourceManagerStats writerStats() { return _resourceManager.stats(); }
+
+  // Memory retained by the current and the historic generations, and by
+  // generations in the trash which are not yet freed.
+  size_t memoryUsage() const {
+    return _history.retainedBytes() + _history.pendingBytes();
+  }
+};
+
+} // namespace arangodb
@@ -1,5 +1,8 @@
 #include "BoundedList.h"
 #include "BoundedList2.h"
+#include "LatencyHistogram.h"
+#include "RingBoundedList.h"
+#include "ShardedBoundedList.h"
 #include <algorithm>
 #include <atomic>
 #include <chrono>
@@ -8,7 +11,9 @@
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#ifdef USE_JEMALLOC
 #include <jemalloc/jemalloc.h>
+#endif
 #include <mutex>
 #include <numeric>
 #include <string>
@@ -29,8 +34,9 @@ public:
   // Copy constructor
   Payload(const Payload &other) = default;
 
-  // Move constructor
-  Payload(Payload &&other) noexcept : a(other.a), b(other.b) {}
+  // Move constructor, defaulted to keep Payload trivially copyable, which
+  // RingBoundedList needs
+  Payload(Payload &&other) noexcept = default;
 
   // Memory usage estimation
   size_t memoryUsage() const { return sizeof(Payload); }
@@ -44,6 +50,10 @@ struct BenchmarkConfig {
   size_t max_history = 10;
   bool csv_output = false;
   std::string output_file = "bounded_list_benchmark.csv";
+  bool arena = false; // Allocate list nodes in per-thread chunks
+  bool reclaimer = false; // Free the trash in a background thread
+  size_t batch_size = 1;  // Items per prepend_batch call
+  int sample_every = 1;   // Measure the latency of every Nth call
 
   static BenchmarkConfig parse_args(int argc, char *argv[]) {
     BenchmarkConfig config;
@@ -68,6 +78,16 @@ struct BenchmarkConfig {
       } else if (arg == "-o" || arg == "--output") {
         if (++i < argc)
           config.output_file = argv[i];
+      } else if (arg == "--arena") {
+        config.arena = true;
+      } else if (arg == "--reclaimer") {
+        config.reclaimer = true;
+      } else if (arg == "-s" || arg == "--sample") {
+        if (++i < argc)
+          config.sample_every = std::max(1, std::stoi(argv[i]));
+      } else if (arg == "-b" || arg == "--batch") {
+        if (++i < argc)
+          config.batch_size = std::max<size_t>(1, std::stoul(argv[i]));
       } else if (arg == "--help") {
         std::cout
             << "Usage: " << argv[0] << " [options]\n"
@@ -81,6 +101,12 @@ struct BenchmarkConfig {
             << "  --csv              Output results in CSV format\n"
             << "  -o, --output FILE  Output file for CSV results (default: "
                "bounded_list_benchmark.csv)\n"
+            << "  --arena            Use arena allocated list nodes\n"
+            << "  --reclaimer        Free the trash in a background thread\n"
+            << "  -b, --batch N      Prepend N items per call, if supported "
+               "(default: 1)\n"
+            << "  -s, --sample N     Measure the latency of every Nth call "
+               "(default: 1)\n"
             << "  --help             Show this help message\n";
         exit(0);
       }
@@ -90,11 +116,11 @@ struct BenchmarkConfig {
   }
 };
 
-// Statistics for a writer thread
+// Statistics for a writer thread. Each writer owns its stats, so recording
+// needs no synchronization, they are only looked at after the join.
 class WriterStats {
 private:
-  std::vector<double> latencies; // in nanoseconds
-  std::unique_ptr<std::mutex> stats_mutex;
+  LatencyHistogram latencies; // in nanoseconds
   int thread_id;
   uint64_t total_writes = 0;
   double duration_secs = 0.0;
@@ -102,41 +128,12 @@ private:
 
 public:
   explicit WriterStats(int id, const std::string &impl_name = "")
-      : stats_mutex(std::make_unique<std::mutex>()), thread_id(id),
-        implementation_name(impl_name) {
-    // Pre-allocate space to avoid reallocations
-    latencies.reserve(20000000);
-  }
+      : thread_id(id), implementation_name(impl_name) {}
 
-  // Delete copy constructor
-  WriterStats(const WriterStats &) = delete;
-  WriterStats &operator=(const WriterStats &) = delete;
-
-  // Move constructor
-  WriterStats(WriterStats &&other) noexcept
-      : latencies(std::move(other.latencies)),
-        stats_mutex(std::move(other.stats_mutex)), thread_id(other.thread_id),
-        total_writes(other.total_writes), duration_secs(other.duration_secs),
-        implementation_name(std::move(other.implementation_name)) {}
-
-  // Move assignment
-  WriterStats &operator=(WriterStats &&other) noexcept {
-    if (this != &other) {
-      latencies = std::move(other.latencies);
-      stats_mutex = std::move(other.stats_mutex);
-      thread_id = other.thread_id;
-      total_writes = other.total_writes;
-      duration_secs = other.duration_secs;
-      implementation_name = std::move(other.implementation_name);
-    }
-    return *this;
-  }
+  // Count writes, only sampled writes have their latency recorded
+  void count_writes(uint64_t writes) { total_writes += writes; }
 
-  void record_latency(double latency_ns) {
-    std::lock_guard<std::mutex> lock(*stats_mutex);
-    latencies.push_back(latency_ns);
-    total_writes++;
-  }
+  void record_latency(double latency_ns) { latencies.record(latency_ns); }
 
   void set_duration(double secs) { duration_secs = secs; }
 
@@ -148,33 +145,16 @@ public:
 
   uint64_t get_total_writes() const { return total_writes; }
 
+  LatencyHistogram const &get_latencies() const { return latencies; }
+
   double get_writes_per_second() const {
     return (duration_secs > 0) ? (total_writes / duration_secs) : 0;
   }
 
-  double get_average_latency() const {
-    if (latencies.empty())
-      return 0.0;
-    return std::accumulate(latencies.begin(), latencies.end(), 0.0) /
-           latencies.size();
-  }
+  double get_average_latency() const { return latencies.mean(); }
 
   double get_percentile(double percentile) const {
-    if (latencies.empty())
-      return 0.0;
-
-    size_t idx = static_cast<size_t>(percentile * latencies.size());
-    if (idx >= latencies.size())
-      idx = latencies.size() - 1;
-
-    return latencies[idx];
-  }
-
-  void sort_latencies() {
-    std::cout << "Sorting latencies for " << implementation_name << " thread "
-              << thread_id << "..." << std::endl;
-    std::sort(latencies.begin(), latencies.end());
-    std::cout << "Done." << std::endl;
+    return latencies.percentile(percentile);
   }
 
   void print_stats() const {
@@ -218,12 +198,52 @@ public:
 // Writer function for BoundedList
 template <typename ListType>
 void writer_function(std::shared_ptr<ListType> list, WriterStats &stats,
-                     std::atomic<bool> &should_stop, int thread_id) {
+                     std::atomic<bool> &should_stop, int thread_id,
+                     size_t batch_size, int sample_every) {
   uint64_t counter = 0;
   std::string prefix = "Thread-" + std::to_string(thread_id) + "-Item-";
+  int until_sample = 0;
+
+  if constexpr (requires(std::vector<Payload> &batch) {
+                  list->prepend_batch(std::move(batch));
+                }) {
+    if (batch_size > 1) {
+      std::vector<Payload> batch;
+      batch.reserve(batch_size);
+      while (!should_stop.load(std::memory_order_relaxed)) {
+        batch.clear();
+        for (size_t i = 0; i < batch_size; ++i) {
+          batch.emplace_back(counter, 2 * counter);
+        }
+
+        stats.count_writes(batch_size);
+        if (until_sample-- > 0) {
+          list->prepend_batch(std::move(batch));
+          continue;
+        }
+        until_sample = sample_every - 1;
+
+        // Measure the batch, and record the share of an item
+        auto start = std::chrono::high_resolution_clock::now();
+        list->prepend_batch(std::move(batch));
+        auto end = std::chrono::high_resolution_clock::now();
+
+        stats.record_latency(
+            std::chrono::duration<double, std::nano>(end - start).count() /
+            batch_size);
+      }
+      return;
+    }
+  }
 
   while (!should_stop.load(std::memory_order_relaxed)) {
     Payload payload(counter, 2 * counter);
+    stats.count_writes(1);
+    if (until_sample-- > 0) {
+      list->prepend(std::move(payload));
+      continue;
+    }
+    until_sample = sample_every - 1;
 
     // Measure prepend latency
     auto start = std::chrono::high_resolution_clock::now();
@@ -251,6 +271,11 @@ void run_benchmark(const BenchmarkConfig &config,
   // Create the list
   auto list =
       std::make_shared<ListType>(config.memory_threshold, config.max_history);
+  if constexpr (requires { list->startReclaimer(); }) {
+    if (config.reclaimer) {
+      list->startReclaimer();
+    }
+  }
 
   // Create writer threads and stats
   std::vector<std::thread> writer_threads;
@@ -269,7 +294,8 @@ void run_benchmark(const BenchmarkConfig &config,
   for (int i = 0; i < config.writer_threads; ++i) {
     writer_threads.emplace_back(writer_function<ListType>, list,
                                 std::ref(writer_stats[i]),
-                                std::ref(should_stop), i);
+                                std::ref(should_stop), i, config.batch_size,
+                                config.sample_every);
   }
 
   // Sleep for the specified duration
@@ -287,11 +313,10 @@ void run_benchmark(const BenchmarkConfig &config,
   double duration_secs =
       std::chrono::duration<double>(end_time - start_time).count();
 
-  // Set duration and sort latencies for stats
+  // Set duration for stats
   uint64_t total_writes = 0;
   for (auto &stats : writer_stats) {
     stats.set_duration(duration_secs);
-    stats.sort_latencies();
     total_writes += stats.get_total_writes();
   }
 
@@ -310,52 +335,24 @@ void run_benchmark(const BenchmarkConfig &config,
   std::cout << "  Writes/sec: " << std::fixed << std::setprecision(2)
             << (total_writes / duration_secs) << std::endl;
 
-  // Calculate and print aggregate stats
-  std::vector<double> all_latencies;
+  // Merge the histograms of all threads for the aggregate stats
+  LatencyHistogram all_latencies;
   for (const auto &stats : writer_stats) {
-    // We need to get all latencies from each thread and combine them
-    // This is a simplification - in a real implementation we would
-    // merge the sorted latency vectors more efficiently
-    for (size_t i = 0; i < stats.get_total_writes(); ++i) {
-      double percentile = static_cast<double>(i) / stats.get_total_writes();
-      all_latencies.push_back(stats.get_percentile(percentile));
-    }
-  }
-
-  std::sort(all_latencies.begin(), all_latencies.end());
-
-  double avg_latency = 0;
-  if (!all_latencies.empty()) {
-    avg_latency =
-        std::accumulate(all_latencies.begin(), all_latencies.end(), 0.0) /
-        all_latencies.size();
+    all_latencies.merge(stats.get_latencies());
   }
 
   std::cout << "\nAggregate stats for " << implementation_name << ":"
             << std::endl;
   std::cout << "  Median latency: " << std::fixed << std::setprecision(2)
-            << (all_latencies.empty() ? 0.0
-                                      : all_latencies[all_latencies.size() / 2])
-            << " ns" << std::endl;
+            << all_latencies.percentile(0.5) << " ns" << std::endl;
   std::cout << "  Average latency: " << std::fixed << std::setprecision(2)
-            << avg_latency << " ns" << std::endl;
-  std::cout
-      << "  90%ile latency: " << std::fixed << std::setprecision(2)
-      << (all_latencies.empty()
-              ? 0.0
-              : all_latencies[static_cast<size_t>(0.9 * all_latencies.size())])
-      << " ns" << std::endl;
-  std::cout
-      << "  99%ile latency: " << std::fixed << std::setprecision(2)
-      << (all_latencies.empty()
-              ? 0.0
-              : all_latencies[static_cast<size_t>(0.99 * all_latencies.size())])
-      << " ns" << std::endl;
+            << all_latencies.mean() << " ns" << std::endl;
+  std::cout << "  90%ile latency: " << std::fixed << std::setprecision(2)
+            << all_latencies.percentile(0.9) << " ns" << std::endl;
+  std::cout << "  99%ile latency: " << std::fixed << std::setprecision(2)
+            << all_latencies.percentile(0.99) << " ns" << std::endl;
   std::cout << "  99.9%ile latency: " << std::fixed << std::setprecision(2)
-            << (all_latencies.empty() ? 0.0
-                                      : all_latencies[static_cast<size_t>(
-                                            0.999 * all_latencies.size())])
-            << " ns" << std::endl;
+            << all_latencies.percentile(0.999) << " ns" << std::endl;
 
   // Write CSV output if requested
   if (config.csv_output) {
@@ -375,28 +372,34 @@ void run_benchmark(const BenchmarkConfig &config,
     // Write aggregate stats
     csv_file << implementation_name << ",aggregate," << total_writes << ","
              << std::fixed << std::setprecision(2)
-             << (total_writes / duration_secs) << "," << std::fixed
-             << std::setprecision(2)
-             << (all_latencies.empty()
-                     ? 0.0
-                     : all_latencies[all_latencies.size() / 2])
-             << "," << std::fixed << std::setprecision(2) << avg_latency << ","
-             << std::fixed << std::setprecision(2)
-             << (all_latencies.empty() ? 0.0
-                                       : all_latencies[static_cast<size_t>(
-                                             0.9 * all_latencies.size())])
-             << "," << std::fixed << std::setprecision(2)
-             << (all_latencies.empty() ? 0.0
-                                       : all_latencies[static_cast<size_t>(
-                                             0.99 * all_latencies.size())])
-             << "," << std::fixed << std::setprecision(2)
-             << (all_latencies.empty() ? 0.0
-                                       : all_latencies[static_cast<size_t>(
-                                             0.999 * all_latencies.size())])
-             << ",aggregate\n";
+             << (total_writes / duration_secs) << ","
+             << all_latencies.percentile(0.5) << "," << all_latencies.mean()
+             << "," << all_latencies.percentile(0.9) << ","
+             << all_latencies.percentile(0.99) << ","
+             << all_latencies.percentile(0.999) << ",aggregate\n";
   }
 }
 
+// Run the benchmark for all list implementations
+template <bool Arena>
+void run_all(const BenchmarkConfig &config, const std::string &suffix) {
+  // Run benchmark for BoundedList
+  run_benchmark<BoundedList<Payload, Arena>>(config, "BoundedList" + suffix);
+
+  std::cout << "\n\n";
+  // malloc_stats_print(nullptr, nullptr, nullptr);
+
+  // Run benchmark for BoundedList2
+  run_benchmark<BoundedList2<Payload, Arena>>(config,
+                                              "BoundedList2" + suffix);
+
+  std::cout << "\n\n";
+
+  // Run benchmark for ShardedBoundedList
+  run_benchmark<ShardedBoundedList<Payload, Arena>>(
+      config, "ShardedBoundedList" + suffix);
+}
+
 } // namespace arangodb
 
 int main(int argc, char *argv[]) {
@@ -404,16 +407,20 @@ int main(int argc, char *argv[]) {
 
   auto config = BenchmarkConfig::parse_args(argc, argv);
 
-  std::cout << "=== BoundedList vs BoundedList2 Benchmark ===" << std::endl;
+  std::cout << "=== BoundedList vs BoundedList2 vs ShardedBoundedList vs "
+               "RingBoundedList Benchmark ==="
+            << std::endl;
 
-  // Run benchmark for BoundedList
-  run_benchmark<BoundedList<Payload>>(config, "BoundedList");
+  if (config.arena) {
+    run_all<true>(config, " (arena)");
+  } else {
+    run_all<false>(config, "");
+  }
 
   std::cout << "\n\n";
-  // malloc_stats_print(nullptr, nullptr, nullptr);
 
-  // Run benchmark for BoundedList2
-  run_benchmark<BoundedList2<Payload>>(config, "BoundedList2");
+  // Run benchmark for RingBoundedList, which has no nodes to allocate
+  run_benchmark<RingBoundedList<Payload>>(config, "RingBoundedList");
 
   // malloc_stats_print(nullptr, nullptr, nullptr);
   return 0;
@@ -0,0 +1,494 @@
+#include "BoundedList.h"
+#include "BoundedList2.h"
+#include "LatencyHistogram.h"
+#include "RWLockResourceManager.h"
+#include "ResourceManager.h"
+#include "RingBoundedList.h"
+#include "ShardedBoundedList.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#ifdef USE_JEMALLOC
+#include <jemalloc/jemalloc.h>
+#endif
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The benchmark driver runs every implementation through a matrix of mixed
+// workloads and writes one machine readable record per run:
+//  - "read/update" for the resource managers: reader threads read, holding
+//    the resource for a configurable time, while a writer updates it at a
+//    given rate and waits for the reclamation of the old version.
+//  - "prepend/snapshot" for the bounded lists: writer threads prepend as
+//    fast as they can, while a snapshot thread calls forItems at a given
+//    rate.
+// The number of reader or writer threads is swept automatically, threads
+// can be pinned to cores, and the results go to CSV or JSON, so that runs
+// of different releases can be compared by a script.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct DriverConfig {
+  std::vector<int> threads; // empty means sweep 1, 2, 4, ... cores
+  int duration_ms = 2000;
+  uint64_t hold_ns = 0;   // time a reader holds the resource
+  int update_rate = 100;  // updates per second, 0 means unpaced
+  int snapshot_rate = 10; // snapshots per second, 0 means unpaced
+  int sample_every = 1;   // measure the latency of every Nth operation
+  bool pin = false;
+  size_t memory_threshold = 1024 * 1024;
+  size_t max_history = 10;
+  bool json = false;
+  std::string output_file; // empty means stdout
+  std::string only;        // run only implementations containing this
+
+  static std::vector<int> parse_list(std::string const &list) {
+    std::vector<int> result;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      if (!item.empty()) {
+        result.push_back(std::max(1, std::stoi(item)));
+      }
+    }
+    return result;
+  }
+
+  static DriverConfig parse_args(int argc, char *argv[]) {
+    DriverConfig config;
+
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+
+      if (arg == "-t" || arg == "--threads") {
+        if (++i < argc)
+          config.threads = parse_list(argv[i]);
+      } else if (arg == "-d" || arg == "--duration") {
+        if (++i < argc)
+          config.duration_ms = std::stoi(argv[i]);
+      } else if (arg == "--hold") {
+        if (++i < argc)
+          config.hold_ns = std::stoull(argv[i]);
+      } else if (arg == "-u" || arg == "--updates") {
+        if (++i < argc)
+          config.update_rate = std::stoi(argv[i]);
+      } else if (arg == "--snapshots") {
+        if (++i < argc)
+          config.snapshot_rate = std::stoi(argv[i]);
+      } else if (arg == "-s" || arg == "--sample") {
+        if (++i < argc)
+          config.sample_every = std::max(1, std::stoi(argv[i]));
+      } else if (arg == "--pin") {
+        config.pin = true;
+      } else if (arg == "-m" || arg == "--memory") {
+        if (++i < argc)
+          config.memory_threshold = std::stoul(argv[i]);
+      } else if (arg == "--history") {
+        if (++i < argc)
+          config.max_history = std::stoul(argv[i]);
+      } else if (arg == "--json") {
+        config.json = true;
+      } else if (arg == "-o" || arg == "--output") {
+        if (++i < argc)
+          config.output_file = argv[i];
+      } else if (arg == "--only") {
+        if (++i < argc)
+          config.only = argv[i];
+      } else if (arg == "-h" || arg == "--help") {
+        std::cout
+            << "Usage: " << argv[0] << " [options]\n"
+            << "Options:\n"
+            << "  -t, --threads LIST Reader/writer thread counts, e.g. 1,4,16\n"
+            << "                     (default: 1, 2, 4, ... up to all cores)\n"
+            << "  -d, --duration MS  Duration of every run in milliseconds "
+               "(default: 2000)\n"
+            << "  --hold NS          Time readers hold the resource "
+               "(default: 0)\n"
+            << "  -u, --updates N    Updates per second, 0 is unpaced "
+               "(default: 100)\n"
+            << "  --snapshots N      Snapshots per second, 0 is unpaced "
+               "(default: 10)\n"
+            << "  -s, --sample N     Measure the latency of every Nth "
+               "operation (default: 1)\n"
+            << "  --pin              Pin every thread to its own core\n"
+            << "  -m, --memory N     Memory threshold of the lists in bytes "
+               "(default: 1048576)\n"
+            << "  --history N        Max history of the lists (default: 10)\n"
+            << "  --json             Write JSON instead of CSV\n"
+            << "  -o, --output FILE  Output file (default: stdout)\n"
+            << "  --only NAME        Only run implementations containing "
+               "NAME\n"
+            << "  -h, --help         Show this help message\n";
+        exit(0);
+      }
+    }
+
+    if (config.threads.empty()) {
+      int cores = std::max(1u, std::thread::hardware_concurrency());
+      for (int n = 1; n < cores; n *= 2) {
+        config.threads.push_back(n);
+      }
+      config.threads.push_back(cores);
+    }
+    return config;
+  }
+};
+
+// Result of one run. The "background" operations are the updates of the
+// read/update workload and the snapshots of the prepend/snapshot workload.
+struct Result {
+  std::string implementation;
+  std::string workload;
+  int threads = 0;
+  double seconds = 0.0;
+  uint64_t ops = 0;
+  LatencyHistogram latency;
+  uint64_t background_ops = 0;
+  LatencyHistogram background_latency;
+  uint64_t items_per_snapshot = 0;
+};
+
+// Per-thread measurements, each on cache lines of its own
+struct alignas(64) ThreadStats {
+  uint64_t ops = 0;
+  LatencyHistogram latency;
+};
+
+void pin_thread(DriverConfig const &config, int index) {
+#ifdef __linux__
+  if (!config.pin) {
+    return;
+  }
+  int cores = std::max(1u, std::thread::hardware_concurrency());
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(index % cores, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+void spin_for(uint64_t ns) {
+  if (ns == 0) {
+    return;
+  }
+  auto deadline = Clock::now() + std::chrono::nanoseconds(ns);
+  while (Clock::now() < deadline) {
+    cpu_relax();
+  }
+}
+
+double elapsed_ns(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+      .count();
+}
+
+// Run `op` until `stop` is set, timing every `sample_every`th call.
+template <typename Op>
+void measure_loop(DriverConfig const &config, std::atomic<bool> &stop,
+                  ThreadStats &stats, Op &&op) {
+  int until_sample = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    ++stats.ops;
+    if (until_sample-- > 0) {
+      op();
+      continue;
+    }
+    until_sample = config.sample_every - 1;
+    auto start = Clock::now();
+    op();
+    stats.latency.record(elapsed_ns(start));
+  }
+}
+
+// Run `op` `rate` times per second until `stop` is set, timing every call.
+template <typename Op>
+void paced_loop(int rate, std::atomic<bool> &stop, ThreadStats &stats,
+                Op &&op) {
+  auto interval = std::chrono::nanoseconds(rate > 0 ? 1000000000 / rate : 0);
+  auto next = Clock::now();
+  while (!stop.load(std::memory_order_relaxed)) {
+    auto start = Clock::now();
+    op();
+    stats.latency.record(elapsed_ns(start));
+    ++stats.ops;
+    if (rate > 0) {
+      next += interval;
+      std::this_thread::sleep_until(next);
+    }
+  }
+}
+
+// Start `threads` workers and one background thread, stop them after the
+// configured duration and collect their measurements.
+template <typename Worker, typename Background>
+void run_threads(DriverConfig const &config, int threads, Result &result,
+                 Worker &&worker, Background &&background) {
+  std::atomic<bool> stop{false};
+  std::vector<std::unique_ptr<ThreadStats>> stats;
+  for (int i = 0; i < threads; ++i) {
+    stats.push_back(std::make_unique<ThreadStats>());
+  }
+  ThreadStats background_stats;
+
+  auto start = Clock::now();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&, i]() {
+      pin_thread(config, i);
+      worker(i, stop, *stats[i]);
+    });
+  }
+  std::thread background_thread([&]() {
+    pin_thread(config, threads);
+    background(stop, background_stats);
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(config.duration_ms));
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+  background_thread.join();
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  result.threads = threads;
+  for (auto const &s : stats) {
+    result.ops += s->ops;
+    result.latency.merge(s->latency);
+  }
+  result.background_ops = background_stats.ops;
+  result.background_latency.merge(background_stats.latency);
+}
+
+template <typename Manager, typename Make>
+Result run_manager(DriverConfig const &config, std::string const &name,
+                   int threads, Make &&make) {
+  Result result;
+  result.implementation = name;
+  result.workload = "read/update";
+  std::shared_ptr<Manager> manager = make();
+
+  run_threads(
+      config, threads, result,
+      [&](int, std::atomic<bool> &stop, ThreadStats &stats) {
+        measure_loop(config, stop, stats, [&]() {
+          manager->read([&config](std::string const &resource) {
+            spin_for(config.hold_ns);
+            volatile size_t len = resource.length();
+            return len;
+          });
+        });
+      },
+      [&](std::atomic<bool> &stop, ThreadStats &stats) {
+        uint64_t counter = 0;
+        paced_loop(config.update_rate, stop, stats, [&]() {
+          auto [old_value, epoch] =
+              manager->update(std::make_unique<std::string>(
+                  "Updated resource " + std::to_string(++counter)));
+          manager->wait_reclaim(epoch);
+        });
+      });
+  return result;
+}
+
+// Record which is small and trivially copyable, so it suits all lists
+struct Entry {
+  uint64_t writer;
+  uint64_t seq;
+
+  size_t memoryUsage() const { return sizeof(Entry); }
+};
+
+template <typename List>
+Result run_list(DriverConfig const &config, std::string const &name,
+                int threads) {
+  Result result;
+  result.implementation = name;
+  result.workload = "prepend/snapshot";
+  List list(config.memory_threshold, config.max_history);
+  if constexpr (requires { list.startReclaimer(); }) {
+    list.startReclaimer();
+  }
+
+  uint64_t items = 0;
+  run_threads(
+      config, threads, result,
+      [&](int index, std::atomic<bool> &stop, ThreadStats &stats) {
+        uint64_t seq = 0;
+        measure_loop(config, stop, stats, [&]() {
+          list.prepend(Entry{static_cast<uint64_t>(index), seq++});
+        });
+      },
+      [&](std::atomic<bool> &stop, ThreadStats &stats) {
+        paced_loop(config.snapshot_rate, stop, stats, [&]() {
+          list.forItems([&items](Entry const &) { ++items; });
+        });
+        if constexpr (!requires { list.startReclaimer(); }) {
+          list.clearTrash();
+        }
+      });
+  result.items_per_snapshot =
+      result.background_ops > 0 ? items / result.background_ops : 0;
+  return result;
+}
+
+ResourceManagerOptions protocol_options(ReadProtocol protocol) {
+  ResourceManagerOptions options;
+  options.read_protocol = protocol;
+  if (protocol != ReadProtocol::CompareExchange) {
+    options.slot_assignment = SlotAssignment::Registered;
+  }
+  return options;
+}
+
+// Column names, shared by the CSV header and the JSON keys
+const char *const COLUMNS[] = {
+    "implementation", "workload",       "threads",          "hold_ns",
+    "update_rate",    "snapshot_rate",  "seconds",          "ops",
+    "ops_per_sec",    "p50_ns",         "p90_ns",           "p99_ns",
+    "p999_ns",        "max_ns",         "background_ops",   "background_p50_ns",
+    "background_p99_ns", "background_max_ns", "items_per_snapshot"};
+
+std::vector<std::string> row(DriverConfig const &config, Result const &r) {
+  auto num = [](double value) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2) << value;
+    return ss.str();
+  };
+  return {r.implementation,
+          r.workload,
+          std::to_string(r.threads),
+          std::to_string(config.hold_ns),
+          std::to_string(config.update_rate),
+          std::to_string(config.snapshot_rate),
+          num(r.seconds),
+          std::to_string(r.ops),
+          num(r.seconds > 0 ? r.ops / r.seconds : 0.0),
+          num(r.latency.percentile(0.5)),
+          num(r.latency.percentile(0.9)),
+          num(r.latency.percentile(0.99)),
+          num(r.latency.percentile(0.999)),
+          std::to_string(r.latency.max_value()),
+          std::to_string(r.background_ops),
+          num(r.background_latency.percentile(0.5)),
+          num(r.background_latency.percentile(0.99)),
+          std::to_string(r.background_latency.max_value()),
+          std::to_string(r.items_per_snapshot)};
+}
+
+void write_results(DriverConfig const &config,
+                   std::vector<Result> const &results, std::ostream &out) {
+  if (config.json) {
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+      auto values = row(config, results[i]);
+      out << "  {";
+      for (size_t c = 0; c < values.size(); ++c) {
+        // The first two columns are strings
+        bool quote = c < 2;
+        out << (c > 0 ? ", " : "") << "\"" << COLUMNS[c] << "\": "
+            << (quote ? "\"" : "") << values[c] << (quote ? "\"" : "");
+      }
+      out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+  } else {
+    for (size_t c = 0; c < std::size(COLUMNS); ++c) {
+      out << (c > 0 ? "," : "") << COLUMNS[c];
+    }
+    out << "\n";
+    for (auto const &result : results) {
+      auto values = row(config, result);
+      for (size_t c = 0; c < values.size(); ++c) {
+        out << (c > 0 ? "," : "") << values[c];
+      }
+      out << "\n";
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  using namespace arangodb;
+
+  DriverConfig config = DriverConfig::parse_args(argc, argv);
+  std::vector<Result> results;
+
+  auto selected = [&config](std::string const &name) {
+    return config.only.empty() || name.find(config.only) != std::string::npos;
+  };
+  auto run = [&](std::string const &name, auto &&benchmark) {
+    if (!selected(name)) {
+      return;
+    }
+    for (int threads : config.threads) {
+      std::cerr << "Running " << name << " with " << threads << " threads"
+                << std::endl;
+      results.push_back(benchmark(threads));
+    }
+  };
+
+  using Epoch = ResourceManager<std::string>;
+  using RWLock = RWLockResourceManager<std::string>;
+  for (auto [protocol, suffix] :
+       {std::pair{ReadProtocol::CompareExchange, "cas"},
+        std::pair{ReadProtocol::StoreFence, "fence"},
+        std::pair{ReadProtocol::Asymmetric, "asymmetric"}}) {
+    std::string name = std::string("EpochBased(") + suffix + ")";
+    run(name, [&, protocol](int threads) {
+      return run_manager<Epoch>(config, name, threads, [protocol]() {
+        return std::make_shared<Epoch>(
+            std::make_unique<std::string>("Initial resource"),
+            protocol_options(protocol));
+      });
+    });
+  }
+  run("RWLock", [&](int threads) {
+    return run_manager<RWLock>(config, "RWLock", threads, []() {
+      return std::make_shared<RWLock>(
+          std::make_unique<std::string>("Initial resource"));
+    });
+  });
+
+  run("BoundedList", [&](int threads) {
+    return run_list<BoundedList<Entry>>(config, "BoundedList", threads);
+  });
+  run("BoundedList2", [&](int threads) {
+    return run_list<BoundedList2<Entry>>(config, "BoundedList2", threads);
+  });
+  run("ShardedBoundedList", [&](int threads) {
+    return run_list<ShardedBoundedList<Entry>>(config, "ShardedBoundedList",
+                                               threads);
+  });
+  run("RingBoundedList", [&](int threads) {
+    return run_list<RingBoundedList<Entry>>(config, "RingBoundedList",
+                                            threads);
+  });
+
+  if (config.output_file.empty()) {
+    write_results(config, results, std::cout);
+  } else {
+    std::ofstream out(config.output_file);
+    if (!out.is_open()) {
+      std::cerr << "Error: Could not open " << config.output_file
+                << std::endl;
+      return 1;
+    }
+    write_results(config, results, out);
+    std::cerr << "Results written to " << config.output_file << std::endl;
+  }
+  return 0;
+}
@@ -1,3 +1,7 @@
+#include "HazardDomain.h"
+#include "LatencyHistogram.h"
+#include "QuiescentDomain.h"
+#include "RWLockResourceManager.h"
 #include "ResourceManager.h"
 #include <algorithm>
 #include <atomic>
@@ -7,7 +11,9 @@
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#ifdef USE_JEMALLOC
 #include <jemalloc/jemalloc.h>
+#endif
 #include <mutex>
 #include <numeric>
 #include <shared_mutex>
@@ -15,44 +21,6 @@
 #include <thread>
 #include <vector>
 
-// Standard read-write lock based resource manager for comparison
-template <typename T> class RWLockResourceManager {
-private:
-  std::unique_ptr<T> resource;
-  mutable std::shared_mutex mutex;
-
-public:
-  explicit RWLockResourceManager(std::unique_ptr<T> initial_resource)
-      : resource(std::move(initial_resource)) {}
-
-  ~RWLockResourceManager() = default;
-
-  // Delete copy/move constructors and assignment operators
-  RWLockResourceManager(const RWLockResourceManager &) = delete;
-  RWLockResourceManager &operator=(const RWLockResourceManager &) = delete;
-  RWLockResourceManager(RWLockResourceManager &&) = delete;
-  RWLockResourceManager &operator=(RWLockResourceManager &&) = delete;
-
-  // Reader API: Get access to the resource
-  template <typename F>
-  auto read(F &&f) -> decltype(f(std::declval<const T &>())) {
-    std::shared_lock<std::shared_mutex> lock(mutex);
-    return f(*resource);
-  }
-
-  // Writer API: Update the resource
-  std::pair<std::unique_ptr<T>, uint64_t>
-  update(std::unique_ptr<T> new_resource) {
-    std::unique_lock<std::shared_mutex> lock(mutex);
-    std::unique_ptr<T> old_resource = std::move(resource);
-    resource = std::move(new_resource);
-    return std::make_pair(std::move(old_resource), 0); // No epoch needed
-  }
-
-  // No-op for compatibility with ResourceManager API
-  void wait_reclaim(uint64_t) {}
-};
-
 // Command line argument parser
 struct BenchmarkConfig {
   int reader_threads = 4;
@@ -60,7 +28,28 @@ struct BenchmarkConfig {
   int updates_per_second = 100;
   bool csv_output = false;
   std::string output_file = "benchmark_results.csv";
-  bool run_both = true; // Run both implementations by default
+  bool run_both = true; // Also run the RWLock implementation by default
+  ReadProtocol read_protocol = ReadProtocol::CompareExchange;
+  int sample_every = 1; // Measure the latency of every Nth read
+  bool numa = false;     // Slots per NUMA node
+  bool numa_replicas = false;
+  // Reclamation schemes of the epoch-based implementation to run
+  bool run_ebr = true;
+  bool run_hazard = true;
+  bool run_qsbr = true;
+
+  // Options for the epoch-based implementation. The store based read
+  // protocols need registered slot assignment.
+  ResourceManagerOptions manager_options() const {
+    ResourceManagerOptions options;
+    options.read_protocol = read_protocol;
+    if (read_protocol != ReadProtocol::CompareExchange) {
+      options.slot_assignment = SlotAssignment::Registered;
+    }
+    options.numa = numa || numa_replicas;
+    options.numa_replicas = numa_replicas;
+    return options;
+  }
 
   static BenchmarkConfig parse_args(int argc, char *argv[]) {
     BenchmarkConfig config;
@@ -84,6 +73,31 @@ struct BenchmarkConfig {
           config.output_file = argv[i];
       } else if (arg == "--epoch-only") {
         config.run_both = false;
+      } else if (arg == "-p" || arg == "--protocol") {
+        if (++i < argc) {
+          std::string protocol = argv[i];
+          if (protocol == "fence") {
+            config.read_protocol = ReadProtocol::StoreFence;
+          } else if (protocol == "asymmetric") {
+            config.read_protocol = ReadProtocol::Asymmetric;
+          } else {
+            config.read_protocol = ReadProtocol::CompareExchange;
+          }
+        }
+      } else if (arg == "-s" || arg == "--sample") {
+        if (++i < argc)
+          config.sample_every = std::max(1, std::stoi(argv[i]));
+      } else if (arg == "--numa") {
+        config.numa = true;
+      } else if (arg == "--numa-replicas") {
+        config.numa_replicas = true;
+      } else if (arg == "--scheme") {
+        if (++i < argc) {
+          std::string scheme = argv[i];
+          config.run_ebr = scheme == "ebr" || scheme == "all";
+          config.run_hazard = scheme == "hp" || scheme == "all";
+          config.run_qsbr = scheme == "qsbr" || scheme == "all";
+        }
       } else if (arg == "-h" || arg == "--help") {
         std::cout
             << "Usage: " << argv[0] << " [options]\n"
@@ -96,6 +110,18 @@ struct BenchmarkConfig {
             << "  -o, --output FILE  Output file for CSV results (default: "
                "benchmark_results.csv)\n"
             << "  --epoch-only       Only run the epoch-based implementation\n"
+            << "  -p, --protocol P   Read protocol of the epoch-based "
+               "implementation:\n"
+            << "                     cas, fence or asymmetric (default: cas)\n"
+            << "  -s, --sample N     Measure the latency of every Nth read "
+               "(default: 1)\n"
+            << "  --numa             Give every NUMA node epoch slots of its "
+               "own\n"
+            << "  --numa-replicas    As --numa, and replicate the current "
+               "pointer per node\n"
+            << "  --scheme S         Reclamation of the epoch-based "
+               "implementation:\n"
+            << "                     ebr, hp, qsbr or all (default: all)\n"
             << "  -h, --help         Show this help message\n";
         exit(0);
       }
@@ -105,11 +131,11 @@ struct BenchmarkConfig {
   }
 };
 
-// Statistics for a reader thread
+// Statistics for a reader thread. Each reader owns its stats, so recording
+// needs no synchronization, they are only looked at after the join.
 class ReaderStats {
 private:
-  std::vector<double> latencies; // in nanoseconds
-  std::mutex stats_mutex;
+  LatencyHistogram latencies; // in nanoseconds
   int thread_id;
   uint64_t total_reads = 0;
   double duration_secs = 0.0;
@@ -117,16 +143,12 @@ private:
 
 public:
   explicit ReaderStats(int id, const std::string &impl_name = "")
-      : thread_id(id), implementation_name(impl_name) {
-    // Pre-allocate space to avoid reallocations
-    latencies.reserve(100000000);
-  }
+      : thread_id(id), implementation_name(impl_name) {}
 
-  void record_latency(double latency_us) {
-    std::lock_guard<std::mutex> lock(stats_mutex);
-    latencies.push_back(latency_us);
-    total_reads++;
-  }
+  // Count a read, only sampled reads have their latency recorded
+  void count_read() { total_reads++; }
+
+  void record_latency(double latency_ns) { latencies.record(latency_ns); }
 
   void set_duration(double secs) { duration_secs = secs; }
 
@@ -138,33 +160,16 @@ public:
 
   uint64_t get_total_reads() const { return total_reads; }
 
+  LatencyHistogram const &get_latencies() const { return latencies; }
+
   double get_reads_per_second() const {
     return (duration_secs > 0) ? (total_reads / duration_secs) : 0;
   }
 
-  double get_average_latency() const {
-    if (latencies.empty())
-      return 0.0;
-    return std::accumulate(latencies.begin(), latencies.end(), 0.0) /
-           latencies.size();
-  }
+  double get_average_latency() const { return latencies.mean(); }
 
   double get_percentile(double percentile) const {
-    if (latencies.empty())
-      return 0.0;
-
-    size_t idx = static_cast<size_t>(percentile * latencies.size());
-    if (idx >= latencies.size())
-      idx = latencies.size() - 1;
-
-    return latencies[idx];
-  }
-
-  void sort_latencies() {
-    std::cout << "Sorting latencies for " << implementation_name << " thread "
-              << thread_id << "..." << std::endl;
-    std::sort(latencies.begin(), latencies.end());
-    std::cout << "Done." << std::endl;
+    return latencies.percentile(percentile);
   }
 
   void print_stats() const {
@@ -206,27 +211,39 @@ public:
   }
 };
 
-// Generic reader thread function template
-template <typename ManagerType>
-void reader_function(std::shared_ptr<ManagerType> manager, ReaderStats &stats,
-                     std::atomic<bool> &should_stop) {
+// Reader loop, `after_read` is called after every read
+template <typename ManagerType, typename AfterRead>
+void read_loop(ManagerType &manager, ReaderStats &stats,
+               std::atomic<bool> &should_stop, int sample_every,
+               AfterRead after_read) {
   auto start_time = std::chrono::steady_clock::now();
-
-  while (!should_stop.load(std::memory_order_relaxed)) {
-    // Measure latency of the read operation
-    auto read_start = std::chrono::high_resolution_clock::now();
-
-    manager->read([](const std::string &resource) {
+  auto read = [&manager]() {
+    manager.read([](const std::string &resource) {
       // Just read the resource, don't clone it to avoid measuring clone time
       volatile size_t len = resource.length();
       return len;
     });
+  };
 
+  int until_sample = 0;
+  while (!should_stop.load(std::memory_order_relaxed)) {
+    stats.count_read();
+    if (until_sample-- > 0) {
+      read();
+      after_read();
+      continue;
+    }
+    until_sample = sample_every - 1;
+
+    // Measure latency of the read operation
+    auto read_start = std::chrono::high_resolution_clock::now();
+    read();
     auto read_end = std::chrono::high_resolution_clock::now();
     auto latency =
         std::chrono::duration<double, std::nano>(read_end - read_start).count();
 
     stats.record_latency(latency);
+    after_read();
   }
 
   auto end_time = std::chrono::steady_clock::now();
@@ -234,6 +251,21 @@ void reader_function(std::shared_ptr<ManagerType> manager, ReaderStats &stats,
   stats.set_duration(duration);
 }
 
+// Generic reader thread function template. Readers of a QSBR manager join
+// its domain and report a quiescent state after every read, outside of the
+// measured latency.
+template <typename ManagerType>
+void reader_function(std::shared_ptr<ManagerType> manager, ReaderStats &stats,
+                     std::atomic<bool> &should_stop, int sample_every) {
+  if constexpr (requires { manager->epoch_domain().join(); }) {
+    auto participant = manager->epoch_domain().join();
+    read_loop(*manager, stats, should_stop, sample_every,
+              [&participant]() { participant.quiescent(); });
+  } else {
+    read_loop(*manager, stats, should_stop, sample_every, []() {});
+  }
+}
+
 // Generic writer thread function template
 template <typename ManagerType>
 void writer_function(std::shared_ptr<ManagerType> manager,
@@ -272,7 +304,8 @@ void writer_function(std::shared_ptr<ManagerType> manager,
 // Function to run a single benchmark
 template <typename ManagerType>
 void run_benchmark(const BenchmarkConfig &config,
-                   const std::string &implementation_name) {
+                   const std::string &implementation_name,
+                   bool append_csv = false) {
   std::cout << "\nRunning benchmark for " << implementation_name << ":"
             << std::endl;
   std::cout << "  Reader threads: " << config.reader_threads << std::endl;
@@ -282,8 +315,17 @@ void run_benchmark(const BenchmarkConfig &config,
             << " per second" << std::endl;
 
   // Create a resource manager with initial string
-  auto manager = std::make_shared<ManagerType>(
-      std::make_unique<std::string>("Initial resource"));
+  std::shared_ptr<ManagerType> manager;
+  if constexpr (std::is_constructible_v<ManagerType,
+                                       std::unique_ptr<std::string>,
+                                       ResourceManagerOptions>) {
+    manager = std::make_shared<ManagerType>(
+        std::make_unique<std::string>("Initial resource"),
+        config.manager_options());
+  } else {
+    manager = std::make_shared<ManagerType>(
+        std::make_unique<std::string>("Initial resource"));
+  }
 
   // Create a stop flag to signal threads to stop
   std::atomic<bool> should_stop(false);
@@ -299,7 +341,8 @@ void run_benchmark(const BenchmarkConfig &config,
   std::vector<std::thread> reader_threads;
   for (int i = 0; i < config.reader_threads; ++i) {
     reader_threads.emplace_back(reader_function<ManagerType>, manager,
-                                std::ref(*all_stats[i]), std::ref(should_stop));
+                                std::ref(*all_stats[i]), std::ref(should_stop),
+                                config.sample_every);
   }
 
   // Create atomic counter for updates
@@ -331,9 +374,10 @@ void run_benchmark(const BenchmarkConfig &config,
   uint64_t total_reads = 0;
   double total_duration = 0.0;
 
+  LatencyHistogram all_latencies;
   for (const auto &stats : all_stats) {
-    stats->sort_latencies();
     stats->print_stats();
+    all_latencies.merge(stats->get_latencies());
     std::cout << std::endl;
 
     total_reads += stats->get_total_reads();
@@ -358,16 +402,23 @@ void run_benchmark(const BenchmarkConfig &config,
             << static_cast<double>(update_counter.load()) /
                    config.duration_seconds
             << std::endl;
+  std::cout << "  Median latency: " << std::fixed << std::setprecision(2)
+            << all_latencies.percentile(0.5) << " ns" << std::endl;
+  std::cout << "  Average latency: " << std::fixed << std::setprecision(2)
+            << all_latencies.mean() << " ns" << std::endl;
+  std::cout << "  99%ile latency: " << std::fixed << std::setprecision(2)
+            << all_latencies.percentile(0.99) << " ns" << std::endl;
+  std::cout << "  99.9%ile latency: " << std::fixed << std::setprecision(2)
+            << all_latencies.percentile(0.999) << " ns" << std::endl;
 
   // Return the stats for CSV output if needed
   if (config.csv_output) {
-    std::ofstream csv_file(config.output_file, implementation_name == "RWLock"
-                                                   ? std::ios::app
-                                                   : std::ios::out);
+    std::ofstream csv_file(config.output_file,
+                           append_csv ? std::ios::app : std::ios::out);
 
     if (csv_file.is_open()) {
       // Write header only for the first implementation
-      if (implementation_name != "RWLock") {
+      if (!append_csv) {
         csv_file << all_stats[0]->get_csv_header() << std::endl;
       }
 
@@ -378,8 +429,11 @@ void run_benchmark(const BenchmarkConfig &config,
 
       // Write aggregate row
       csv_file << implementation_name << ",aggregate," << total_reads << ","
-               << std::fixed << std::setprecision(2) << reads_per_second
-               << ",,,,,";
+               << std::fixed << std::setprecision(2) << reads_per_second << ","
+               << all_latencies.percentile(0.5) << "," << all_latencies.mean()
+               << "," << all_latencies.percentile(0.9) << ","
+               << all_latencies.percentile(0.99) << ","
+               << all_latencies.percentile(0.999);
       csv_file << std::endl;
 
       std::cout << "CSV results for " << implementation_name << " written to "
@@ -396,19 +450,35 @@ int main(int argc, char *argv[]) {
 
   std::cout << "Starting benchmark comparison" << std::endl;
 
-  // Run the epoch-based ResourceManager benchmark
-  run_benchmark<ResourceManager<std::string>>(config, "EpochBased");
+  // Run the epoch-based ResourceManager benchmark with each reclamation
+  // scheme
+  bool append_csv = false;
+  if (config.run_ebr) {
+    run_benchmark<ResourceManager<std::string>>(config, "EpochBased");
+    append_csv = true;
+  }
+  if (config.run_hazard) {
+    run_benchmark<ResourceManager<std::string, NoMetrics, HazardDomain>>(
+        config, "HazardPointers", append_csv);
+    append_csv = true;
+  }
+  if (config.run_qsbr) {
+    run_benchmark<ResourceManager<std::string, NoMetrics, QuiescentDomain>>(
+        config, "QSBR", append_csv);
+    append_csv = true;
+  }
 
   // Run the RWLock-based ResourceManager benchmark if requested
   if (config.run_both) {
-    run_benchmark<RWLockResourceManager<std::string>>(config, "RWLock");
+    run_benchmark<RWLockResourceManager<std::string>>(config, "RWLock",
+                                                      append_csv);
 
     // Print comparison summary
     std::cout << "\nComparison Summary:" << std::endl;
     std::cout << "===================" << std::endl;
     std::cout << "See detailed results above for performance metrics."
               << std::endl;
-    std::cout << "The CSV output file contains data for both implementations "
+    std::cout << "The CSV output file contains data for all implementations "
                  "for detailed analysis."
               << std::endl;
   }
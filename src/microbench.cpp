@@ -0,0 +1,328 @@
+#include "BoundedList.h"
+#include "BoundedList2.h"
+#include "HazardDomain.h"
+#include "QuiescentDomain.h"
+#include "ResourceManager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Microbenchmarks of the hot paths (read, update, prepend), in the style of
+// Google Benchmark: every benchmark is a loop `for (auto _ : state)` whose
+// iteration count is raised until the loop runs for at least --min-time,
+// and the result is the time per iteration. The operations are compiled
+// into this binary, so the numbers include inlining (and LTO or PGO, if
+// the build profile enables them), which is what an application sees.
+
+// Keeps the compiler from optimizing away the computation of `value`.
+template <typename T> inline void do_not_optimize(T const &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Loop state of one thread of a benchmark run.
+class State {
+public:
+  State(uint64_t iterations, int thread_index, int threads)
+      : _iterations(iterations), _thread_index(thread_index),
+        _threads(threads) {}
+
+  // The loop variable, which is never used
+  struct [[maybe_unused]] Value {};
+
+  struct Iterator {
+    uint64_t remaining;
+    bool operator!=(Iterator const &) const { return remaining != 0; }
+    void operator++() { --remaining; }
+    Value operator*() const { return {}; }
+  };
+
+  // The clock starts with the loop, the runner stops it when the thread is
+  // done.
+  Iterator begin() {
+    _start = std::chrono::steady_clock::now();
+    return Iterator{_iterations};
+  }
+  Iterator end() { return Iterator{0}; }
+
+  void stop_timer() { _elapsed = std::chrono::steady_clock::now() - _start; }
+
+  uint64_t iterations() const { return _iterations; }
+  int thread_index() const { return _thread_index; }
+  int threads() const { return _threads; }
+  std::chrono::duration<double> elapsed() const { return _elapsed; }
+
+private:
+  uint64_t _iterations;
+  int _thread_index;
+  int _threads;
+  std::chrono::steady_clock::time_point _start;
+  std::chrono::duration<double> _elapsed{0};
+};
+
+// A benchmark creates the shared state of a run (the manager or the list)
+// in `setup` and returns the loop, which every thread of the run executes.
+struct Microbenchmark {
+  std::string name;
+  int threads;
+  std::function<std::function<void(State &)>()> setup;
+};
+
+struct Result {
+  std::string name;
+  int threads;
+  uint64_t iterations;
+  double ns_per_iteration;
+};
+
+// Runs `iterations` iterations in every thread and returns the mean time
+// per iteration and thread.
+double run_once(Microbenchmark const &benchmark, uint64_t iterations) {
+  auto loop = benchmark.setup();
+  std::vector<State> states;
+  for (int i = 0; i < benchmark.threads; ++i) {
+    states.emplace_back(iterations, i, benchmark.threads);
+  }
+  std::latch start(benchmark.threads);
+  std::vector<std::thread> threads;
+  for (auto &state : states) {
+    threads.emplace_back([&loop, &state, &start]() {
+      start.arrive_and_wait();
+      loop(state);
+      state.stop_timer();
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  double seconds = 0;
+  for (auto const &state : states) {
+    seconds += state.elapsed().count();
+  }
+  return seconds / states.size();
+}
+
+// Calibrates the iteration count like Google Benchmark: grow it by the
+// predicted factor (at most 10x) until a run takes at least `min_time`.
+Result run(Microbenchmark const &benchmark, double min_time) {
+  uint64_t iterations = 1;
+  while (true) {
+    double seconds = run_once(benchmark, iterations);
+    if (seconds >= min_time || iterations >= 1'000'000'000) {
+      return Result{benchmark.name, benchmark.threads, iterations,
+                    seconds * 1e9 / iterations};
+    }
+    double multiplier = seconds / min_time > 0.1 ? min_time * 1.4 / seconds
+                                                 : 10.0;
+    iterations = std::max(iterations + 1,
+                          static_cast<uint64_t>(iterations * multiplier));
+  }
+}
+
+// Resource of the manager benchmarks
+struct Resource {
+  uint64_t value;
+};
+
+// Item of the list benchmarks
+struct Item {
+  uint64_t a;
+  uint64_t b;
+  size_t memoryUsage() const { return sizeof(Item); }
+};
+
+template <template <typename> class Reclamation>
+std::function<void(State &)> read_loop(ResourceManagerOptions options = {}) {
+  using Manager = ResourceManager<Resource, NoMetrics, Reclamation>;
+  auto manager = std::make_shared<Manager>(
+      std::make_unique<Resource>(Resource{42}), options);
+  return [manager](State &state) {
+    auto read = [](Resource const &resource) { return resource.value; };
+    if constexpr (requires { manager->epoch_domain().join(); }) {
+      // QSBR readers report a quiescent state after every read
+      auto participant = manager->epoch_domain().join();
+      for (auto _ : state) {
+        do_not_optimize(manager->read(read));
+        participant.quiescent();
+      }
+    } else {
+      for (auto _ : state) {
+        do_not_optimize(manager->read(read));
+      }
+    }
+  };
+}
+
+std::function<void(State &)> update_loop() {
+  auto manager = std::make_shared<ResourceManager<Resource>>(
+      std::make_unique<Resource>(Resource{0}));
+  // There are no readers, so the old resource is freed right away.
+  return [manager](State &state) {
+    uint64_t counter = 0;
+    for (auto _ : state) {
+      auto [old, epoch] = manager->update(
+          std::make_unique<Resource>(Resource{++counter}));
+      do_not_optimize(epoch);
+    }
+  };
+}
+
+std::function<void(State &)> update_deferred_loop() {
+  auto manager = std::make_shared<ResourceManager<Resource>>(
+      std::make_unique<Resource>(Resource{0}));
+  return [manager](State &state) {
+    uint64_t counter = 0;
+    for (auto _ : state) {
+      do_not_optimize(manager->update_deferred(
+          std::make_unique<Resource>(Resource{++counter})));
+    }
+  };
+}
+
+// The lists free their trash in a background thread, otherwise a long run
+// would keep every rotated out list.
+template <typename ListType> std::function<void(State &)> prepend_loop() {
+  auto list = std::make_shared<ListType>(1024 * 1024, 10);
+  list->startReclaimer();
+  return [list](State &state) {
+    uint64_t counter = 0;
+    for (auto _ : state) {
+      list->prepend(Item{++counter, static_cast<uint64_t>(
+                                        state.thread_index())});
+    }
+  };
+}
+
+std::vector<Microbenchmark> all_benchmarks() {
+  std::vector<Microbenchmark> benchmarks;
+  for (int threads : {1, 4}) {
+    std::string suffix =
+        threads == 1 ? "" : "/threads:" + std::to_string(threads);
+    benchmarks.push_back({"read/ebr" + suffix, threads,
+                          [] { return read_loop<EpochDomain>(); }});
+    benchmarks.push_back({"read/ebr/asymmetric" + suffix, threads, [] {
+                            ResourceManagerOptions options;
+                            options.read_protocol = ReadProtocol::Asymmetric;
+                            options.slot_assignment =
+                                SlotAssignment::Registered;
+                            return read_loop<EpochDomain>(options);
+                          }});
+    benchmarks.push_back({"read/hp" + suffix, threads,
+                          [] { return read_loop<HazardDomain>(); }});
+    benchmarks.push_back({"read/qsbr" + suffix, threads,
+                          [] { return read_loop<QuiescentDomain>(); }});
+  }
+  benchmarks.push_back({"update", 1, update_loop});
+  benchmarks.push_back({"update_deferred", 1, update_deferred_loop});
+  for (int threads : {1, 4}) {
+    std::string suffix =
+        threads == 1 ? "" : "/threads:" + std::to_string(threads);
+    benchmarks.push_back(
+        {"prepend/BoundedList" + suffix, threads,
+         prepend_loop<BoundedList<Item>>});
+    benchmarks.push_back(
+        {"prepend/BoundedList2" + suffix, threads,
+         prepend_loop<arangodb::BoundedList2<Item>>});
+    benchmarks.push_back(
+        {"prepend/BoundedList2/arena" + suffix, threads,
+         prepend_loop<arangodb::BoundedList2<Item, true>>});
+  }
+  return benchmarks;
+}
+
+// Command line argument parser
+struct MicrobenchConfig {
+  double min_time = 0.5;            // Seconds per benchmark
+  std::string filter;               // Substring of the benchmark names
+  bool csv_output = false;
+  std::string output_file = "microbench.csv";
+
+  static MicrobenchConfig parse_args(int argc, char *argv[]) {
+    MicrobenchConfig config;
+
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+
+      if (arg == "-t" || arg == "--min-time") {
+        if (++i < argc)
+          config.min_time = std::stod(argv[i]);
+      } else if (arg == "-f" || arg == "--filter") {
+        if (++i < argc)
+          config.filter = argv[i];
+      } else if (arg == "--csv") {
+        config.csv_output = true;
+      } else if (arg == "-o" || arg == "--output") {
+        if (++i < argc)
+          config.output_file = argv[i];
+      } else if (arg == "-l" || arg == "--list") {
+        for (auto const &benchmark : all_benchmarks()) {
+          std::cout << benchmark.name << "\n";
+        }
+        exit(0);
+      } else if (arg == "-h" || arg == "--help") {
+        std::cout
+            << "Usage: " << argv[0] << " [options]\n"
+            << "Options:\n"
+            << "  -t, --min-time S   Minimum time per benchmark in seconds "
+               "(default: 0.5)\n"
+            << "  -f, --filter NAME  Only run benchmarks whose name contains "
+               "NAME\n"
+            << "  -l, --list         List the benchmarks\n"
+            << "  --csv              Output results in CSV format\n"
+            << "  -o, --output FILE  Output file for CSV results (default: "
+               "microbench.csv)\n"
+            << "  -h, --help         Show this help message\n";
+        exit(0);
+      }
+    }
+
+    return config;
+  }
+};
+
+int main(int argc, char *argv[]) {
+  auto config = MicrobenchConfig::parse_args(argc, argv);
+
+  std::cout << std::left << std::setw(36) << "Benchmark" << std::right
+            << std::setw(14) << "Time" << std::setw(14) << "Iterations"
+            << "\n"
+            << std::string(64, '-') << "\n";
+
+  std::vector<Result> results;
+  for (auto const &benchmark : all_benchmarks()) {
+    if (benchmark.name.find(config.filter) == std::string::npos) {
+      continue;
+    }
+    auto result = run(benchmark, config.min_time);
+    std::cout << std::left << std::setw(36) << result.name << std::right
+              << std::setw(11) << std::fixed << std::setprecision(2)
+              << result.ns_per_iteration << " ns" << std::setw(14)
+              << result.iterations << std::endl;
+    results.push_back(result);
+  }
+
+  if (config.csv_output) {
+    std::ofstream csv_file(config.output_file, std::ios::app | std::ios::out);
+
+    // Write header if file is empty
+    csv_file.seekp(0, std::ios::end);
+    if (csv_file.tellp() == 0) {
+      csv_file << "benchmark,threads,iterations,ns_per_iteration\n";
+    }
+    for (auto const &result : results) {
+      csv_file << result.name << "," << result.threads << ","
+               << result.iterations << "," << result.ns_per_iteration << "\n";
+    }
+    std::cout << "Results written to " << config.output_file << std::endl;
+  }
+
+  return 0;
+}